@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "libcvm.h"
+#include "profiler.h"
+#include "workloads.h"
+
+// Counts every heap allocation in the process, so measure() can check that
+// a timed run allocates nothing once the context has warmed up. The bench
+// runs on one thread. Every replaceable form of operator new is counted and
+// served by malloc, so every form of operator delete frees with free(). The
+// aligned forms exist from C++17 on.
+static uint64_t heapAllocations = 0;
+
+static void* countedAlloc(std::size_t size) {
+    ++heapAllocations;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = countedAlloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+#if defined(__cpp_aligned_new)
+static void* countedAlignedAlloc(std::size_t size, std::align_val_t align) {
+    ++heapAllocations;
+    std::size_t alignment = std::max(static_cast<std::size_t>(align), sizeof(void*));
+    void* p = NULL;
+    return posix_memalign(&p, alignment, size == 0 ? 1 : size) == 0 ? p : NULL;
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    if (void* p = countedAlignedAlloc(size, align))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size, std::align_val_t align) { return operator new(size, align); }
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return countedAlignedAlloc(size, align);
+}
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return countedAlignedAlloc(size, align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+#endif
+
+namespace {
+
+struct BenchOptions {
+    BenchOptions() : iterations(30), warmup(5), threshold(10.0) {}
+    cvm::Options vm;
+    size_t iterations;
+    size_t warmup;
+    double threshold;        // Percent slowdown of the median that counts as a regression.
+    std::string filter;      // Only workloads whose name contains this.
+    std::string out;         // JSON results; empty for stdout.
+    std::string baseline;    // Compare against this after the run.
+    std::string emitDir;     // Write the workloads out instead of running them.
+};
+
+struct Result {
+    Result() : instructions(0), outputBytes(0), allocations(0), minNs(0), medianNs(0), p99Ns(0), meanNs(0),
+               opsPerSec(0) {}
+    std::string name;
+    uint64_t instructions; // Dispatches per run.
+    uint64_t outputBytes;
+    uint64_t allocations;  // Most heap allocations made by any timed run.
+    double minNs;
+    double medianNs;
+    double p99Ns;
+    double meanNs;
+    double opsPerSec;      // Dispatches per second at the median.
+};
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--iterations=N] [--warmup=N] [--engine=switch|threaded|register]\n"
+              << "       [--jit] [--no-fuse] [--no-verify] [--filter=NAME] [--out=FILE]\n"
+              << "       [--baseline=FILE] [--threshold=PCT]\n"
+              << "       " << prog << " --compare BASELINE RESULTS [--threshold=PCT]\n"
+              << "       " << prog << " --emit=DIR" << std::endl;
+}
+
+// Nearest-rank percentile of sorted samples.
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+double median(const std::vector<double>& sorted) {
+    size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+}
+
+Result measure(const Workload& workload, const BenchOptions& options) {
+    cvm::Options vm = options.vm;
+    vm.wideCells = workload.wideCells;
+    cvm::ProgramRef program = cvm::loadImage(workload.image.data(), workload.image.size(), vm);
+    cvm::Context context(program, vm);
+    std::string captured;
+    context.output().captureTo(&captured);
+
+    Result result;
+    result.name = workload.name;
+
+    // One profiled run to count dispatches; it is not timed.
+    Profiler profiler(*program);
+    context.setProfiler(&profiler);
+    context.input().readFrom(&workload.input);
+    context.run();
+    context.output().flush();
+    context.setProfiler(NULL);
+    result.instructions = profiler.dispatches();
+    result.outputBytes = captured.size();
+
+    std::vector<double> samples;
+    samples.reserve(options.iterations);
+    for (size_t i = 0; i < options.warmup + options.iterations; ++i) {
+        context.reset();
+        captured.clear(); // Keeps its capacity, so later runs never reallocate.
+        context.input().readFrom(&workload.input);
+        uint64_t allocationsBefore = heapAllocations;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        context.run();
+        context.output().flush();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        uint64_t allocations = heapAllocations - allocationsBefore;
+        if (captured.size() != result.outputBytes)
+            throw std::runtime_error(workload.name + ": output differs between runs");
+        if (i >= options.warmup) {
+            samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+            result.allocations = std::max(result.allocations, allocations);
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+        total += samples[i];
+    result.minNs = samples.front();
+    result.medianNs = median(samples);
+    result.p99Ns = percentile(samples, 99.0);
+    result.meanNs = total / samples.size();
+    result.opsPerSec = result.instructions / (result.medianNs / 1e9);
+    return result;
+}
+
+const char* jitName(JitMode mode) {
+    return mode == JIT_FORCE ? "force" : "off";
+}
+
+void writeJson(std::ostream& out, const BenchOptions& options, const std::vector<Result>& results) {
+    // One workload per line keeps the file diffable and lets readResults()
+    // get by without a JSON parser.
+    out << std::fixed << std::setprecision(0);
+    out << "{\n"
+        << "  \"engine\": \"" << engineName(options.vm.engine) << "\",\n"
+        << "  \"jit\": \"" << jitName(options.vm.jit) << "\",\n"
+        << "  \"fuse\": " << (options.vm.fuse ? "true" : "false") << ",\n"
+        << "  \"verify\": " << (options.vm.verify ? "true" : "false") << ",\n"
+        << "  \"iterations\": " << options.iterations << ",\n"
+        << "  \"warmup\": " << options.warmup << ",\n"
+        << "  \"workloads\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"instructions\": " << r.instructions
+            << ", \"output_bytes\": " << r.outputBytes << ", \"allocations\": " << r.allocations << ", \"min_ns\": " << r.minNs
+            << ", \"median_ns\": " << r.medianNs << ", \"p99_ns\": " << r.p99Ns
+            << ", \"mean_ns\": " << r.meanNs << ", \"ops_per_sec\": " << r.opsPerSec << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Value of `"key": ...` on a line written by writeJson().
+std::string field(const std::string& line, const std::string& key) {
+    std::string quoted = "\"" + key + "\": ";
+    size_t pos = line.find(quoted);
+    if (pos == std::string::npos)
+        return "";
+    pos += quoted.size();
+    if (pos < line.size() && line[pos] == '"') {
+        size_t end = line.find('"', pos + 1);
+        return line.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+    }
+    size_t end = line.find_first_of(",}", pos);
+    return line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+
+std::map<std::string, Result> readResults(const std::string& filename) {
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error("Unable to open results file " + filename);
+    std::map<std::string, Result> results;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string name = field(line, "name");
+        if (name.empty())
+            continue;
+        Result& r = results[name];
+        r.name = name;
+        r.instructions = std::strtoull(field(line, "instructions").c_str(), NULL, 10);
+        r.medianNs = std::atof(field(line, "median_ns").c_str());
+        r.p99Ns = std::atof(field(line, "p99_ns").c_str());
+    }
+    if (results.empty())
+        throw std::runtime_error("No workloads in results file " + filename);
+    return results;
+}
+
+// Prints one line per workload and returns the number of regressions: a
+// median more than `threshold` percent slower than the baseline's.
+size_t compare(const std::map<std::string, Result>& baseline, const std::vector<Result>& current,
+               double threshold) {
+    size_t regressions = 0;
+    std::cout << std::left << std::setw(16) << "workload" << std::right << std::setw(14) << "baseline ms"
+              << std::setw(14) << "current ms" << std::setw(10) << "change" << "  status" << std::endl;
+    for (size_t i = 0; i < current.size(); ++i) {
+        const Result& now = current[i];
+        std::map<std::string, Result>::const_iterator it = baseline.find(now.name);
+        std::cout << std::left << std::setw(16) << now.name << std::right << std::fixed;
+        if (it == baseline.end()) {
+            std::cout << std::setw(14) << "-" << std::setw(14) << std::setprecision(3) << now.medianNs / 1e6
+                      << std::setw(10) << "-" << "  new" << std::endl;
+            continue;
+        }
+        const Result& was = it->second;
+        double change = (now.medianNs - was.medianNs) / was.medianNs * 100.0;
+        const char* status = change > threshold ? "REGRESSION" : change < -threshold ? "faster" : "ok";
+        if (change > threshold)
+            ++regressions;
+        std::cout << std::setw(14) << std::setprecision(3) << was.medianNs / 1e6
+                  << std::setw(14) << now.medianNs / 1e6
+                  << std::setw(9) << std::showpos << std::setprecision(1) << change << "%" << std::noshowpos
+                  << "  " << status;
+        // A different dispatch count means the workload or the load-time
+        // passes changed, so the times are not measuring the same thing.
+        if (was.instructions != 0 && was.instructions != now.instructions)
+            std::cout << " (instructions " << was.instructions << " -> " << now.instructions << ")";
+        std::cout << std::endl;
+    }
+    for (std::map<std::string, Result>::const_iterator it = baseline.begin(); it != baseline.end(); ++it) {
+        bool seen = false;
+        for (size_t i = 0; i < current.size() && !seen; ++i)
+            seen = current[i].name == it->first;
+        if (!seen)
+            std::cout << std::left << std::setw(16) << it->first << "  missing from results" << std::endl;
+    }
+    std::cout << regressions << " regression(s) over " << threshold << "%" << std::endl;
+    return regressions;
+}
+
+void emit(const std::vector<Workload>& workloads, const std::string& dir) {
+    for (size_t i = 0; i < workloads.size(); ++i) {
+        const Workload& w = workloads[i];
+        std::ofstream image(dir + "/" + w.name + ".cb", std::ios::binary);
+        image.write(reinterpret_cast<const char*>(w.image.data()), w.image.size());
+        std::ofstream input(dir + "/" + w.name + ".in", std::ios::binary);
+        input << w.input;
+        if (!image || !input)
+            throw std::runtime_error("Unable to write workload " + w.name + " to " + dir);
+        std::cout << dir << "/" << w.name << ".cb: " << w.description << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    std::vector<std::string> compareFiles;
+    bool compareMode = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 13, "--iterations=") == 0) {
+            long n = std::atol(arg.c_str() + 13);
+            if (n <= 0) {
+                std::cerr << "Invalid iteration count: " << arg << std::endl;
+                return 1;
+            }
+            options.iterations = static_cast<size_t>(n);
+        } else if (arg.compare(0, 9, "--warmup=") == 0) {
+            options.warmup = static_cast<size_t>(std::max(0L, std::atol(arg.c_str() + 9)));
+        } else if (arg == "--engine=switch") {
+            options.vm.engine = ENGINE_SWITCH;
+        } else if (arg == "--engine=threaded") {
+            options.vm.engine = ENGINE_THREADED;
+        } else if (arg == "--engine=register") {
+            options.vm.engine = ENGINE_REGISTER;
+        } else if (arg == "--jit") {
+            options.vm.jit = JIT_FORCE;
+        } else if (arg == "--no-fuse") {
+            options.vm.fuse = false;
+        } else if (arg == "--no-verify") {
+            options.vm.verify = false;
+        } else if (arg.compare(0, 9, "--filter=") == 0) {
+            options.filter = arg.substr(9);
+        } else if (arg.compare(0, 6, "--out=") == 0) {
+            options.out = arg.substr(6);
+        } else if (arg.compare(0, 11, "--baseline=") == 0) {
+            options.baseline = arg.substr(11);
+        } else if (arg.compare(0, 12, "--threshold=") == 0) {
+            options.threshold = std::atof(arg.c_str() + 12);
+        } else if (arg.compare(0, 7, "--emit=") == 0) {
+            options.emitDir = arg.substr(7);
+        } else if (arg == "--compare") {
+            compareMode = true;
+        } else if (compareMode && arg[0] != '-') {
+            compareFiles.push_back(arg);
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        if (compareMode) {
+            if (compareFiles.size() != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            std::map<std::string, Result> current = readResults(compareFiles[1]);
+            std::vector<Result> results;
+            for (std::map<std::string, Result>::const_iterator it = current.begin(); it != current.end(); ++it)
+                results.push_back(it->second);
+            return compare(readResults(compareFiles[0]), results, options.threshold) == 0 ? 0 : 1;
+        }
+
+        std::vector<Workload> workloads = standardWorkloads();
+        if (!options.emitDir.empty()) {
+            emit(workloads, options.emitDir);
+            return 0;
+        }
+
+        std::vector<Result> results;
+        for (size_t i = 0; i < workloads.size(); ++i) {
+            if (workloads[i].name.find(options.filter) == std::string::npos)
+                continue;
+            Result r = measure(workloads[i], options);
+            std::cerr << std::fixed << std::setprecision(3) << "[bench] " << std::left << std::setw(16) << r.name
+                      << std::right << " median " << r.medianNs / 1e6 << " ms, p99 " << r.p99Ns / 1e6
+                      << " ms, " << std::setprecision(1) << r.opsPerSec / 1e6 << " Mops/s, "
+                      << r.allocations << " allocs/run" << std::endl;
+            results.push_back(r);
+        }
+
+        if (options.out.empty()) {
+            writeJson(std::cout, options, results);
+        } else {
+            std::ofstream out(options.out);
+            writeJson(out, options, results);
+            if (!out)
+                throw std::runtime_error("Unable to write " + options.out);
+        }
+
+        if (!options.baseline.empty())
+            return compare(readResults(options.baseline), results, options.threshold) == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdexcept>
+#include "vm.h"
+#include "workloads.h"
+
+Assembler::Assembler() {
+    emit(static_cast<uint8_t>(CUSTOM_MAGIC >> 24));
+    emit(static_cast<uint8_t>(CUSTOM_MAGIC >> 16));
+    emit(static_cast<uint8_t>(CUSTOM_MAGIC >> 8));
+    emit(static_cast<uint8_t>(CUSTOM_MAGIC));
+}
+
+void Assembler::push(uint8_t value) { emit(PUSH); emit(value); }
+void Assembler::add() { emit(ADD); }
+void Assembler::print() { emit(PRINT); }
+void Assembler::println() { emit(PRINTLN); }
+void Assembler::pushVar(char name, uint8_t value) { emit(PUSH_VAR); emit(name); emit(value); }
+void Assembler::loadVar(char name) { emit(LOAD_VAR); emit(name); }
+void Assembler::printVar(char name) { emit(PRINT_VAR); emit(name); }
+void Assembler::toString() { emit(OP_TO_STRING); }
+void Assembler::concat() { emit(OP_CONCAT); }
+void Assembler::compare() { emit(OP_COMPARE); }
+
+void Assembler::input(const std::string& name) {
+    emit(OP_INPUT);
+    emit(static_cast<uint8_t>(name.size()));
+    bytes.insert(bytes.end(), name.begin(), name.end());
+}
+
+void Assembler::loadString(const std::string& text) {
+    if (text.size() > 255)
+        throw std::runtime_error("String literal longer than 255 bytes");
+    emit(OP_LOAD_STRING);
+    emit(static_cast<uint8_t>(text.size()));
+    bytes.insert(bytes.end(), text.begin(), text.end());
+}
+
+size_t Assembler::emitJump(uint8_t opcode, uint16_t offset) {
+    size_t site = here();
+    emit(opcode);
+    emit(static_cast<uint8_t>(offset >> 8));
+    emit(static_cast<uint8_t>(offset));
+    return site;
+}
+
+size_t Assembler::jumpIfZero() { return emitJump(JUMP_IF_ZERO, 0); }
+size_t Assembler::jump() { return emitJump(JUMP, 0); }
+
+void Assembler::patch(size_t site) {
+    size_t offset = here() - (site + 3);
+    if (offset > UINT16_MAX)
+        throw std::runtime_error("Forward jump too long");
+    bytes[site + 1] = static_cast<uint8_t>(offset >> 8);
+    bytes[site + 2] = static_cast<uint8_t>(offset);
+}
+
+namespace {
+
+Workload make(const char* name, const char* description, const Assembler& a,
+              const std::string& input) {
+    Workload w;
+    w.name = name;
+    w.description = description;
+    w.image = a.image();
+    w.input = input;
+    w.wideCells = true;
+    return w;
+}
+
+// Prints "<label><number on top of the stack>" and a newline.
+void printNumber(Assembler& a, const std::string& label) {
+    a.loadString(label);
+    a.toString();
+    a.concat();
+    a.println();
+}
+
+// Nothing but stack arithmetic: a running sum fed by constants and a variable.
+Workload addChain() {
+    Assembler a;
+    a.pushVar('k', 3);
+    a.push(0);
+    for (size_t i = 0; i < 100000; ++i) {
+        a.push(1);
+        a.add();
+        a.loadVar('k');
+        a.add();
+    }
+    printNumber(a, "sum: ");
+    return make("add_chain", "200000 additions of constants and a variable", a, "");
+}
+
+// LOAD_STRING; PUSH; TO_STRING; CONCAT; PRINTLN per line.
+Workload stringBuild() {
+    Assembler a;
+    for (size_t i = 0; i < 50000; ++i) {
+        a.push(static_cast<uint8_t>(i));
+        printNumber(a, "item number ");
+    }
+    return make("string_build", "build 50000 strings from a literal and a number, print them", a, "");
+}
+
+// One ever-growing string: a header literal, then a number appended with
+// TO_STRING; CONCAT per step, printed once at the end, the way a report
+// generator builds its output.
+Workload reportBuild() {
+    Assembler a;
+    a.loadString("report:");
+    for (size_t i = 0; i < 20000; ++i) {
+        a.push(static_cast<uint8_t>(i));
+        a.toString();
+        a.concat();
+    }
+    a.print();
+    a.println();
+    return make("report_build", "append 20000 numbers to one string, print it once", a, "");
+}
+
+// An if/else-if chain on a sweep of values, in the LOAD_VAR; PUSH k;
+// OP_COMPARE; JUMP_IF_ZERO shape covicc emits, so it exercises the fused
+// compare-and-branch as well as the plain branch. Each arm prints its
+// bucket's letter.
+Workload compareBranch() {
+    static const uint8_t thresholds[] = { 200, 150, 100, 50 };
+    static const char buckets[] = "abcde";
+    Assembler a;
+    for (size_t i = 0; i < 20000; ++i) {
+        a.pushVar('j', static_cast<uint8_t>(i * 37 % 251));
+        std::vector<size_t> joins;
+        for (size_t k = 0; k < 4; ++k) {
+            a.loadVar('j');
+            a.push(thresholds[k]);
+            a.compare();
+            size_t next = a.jumpIfZero();
+            a.push(static_cast<uint8_t>(buckets[k]));
+            a.print();
+            joins.push_back(a.jump());
+            a.patch(next);
+        }
+        a.push(static_cast<uint8_t>(buckets[4]));
+        a.print();
+        for (size_t k = 0; k < joins.size(); ++k)
+            a.patch(joins[k]);
+        if (i % 64 == 63)
+            a.println();
+    }
+    a.println();
+    return make("compare_branch", "if/else-if chain over 20000 values", a, "");
+}
+
+// Pages of PUSH c; PRINT pairs, the way covicc compiles a print of a
+// literal.
+Workload literalOutput() {
+    static const char words[] = "the quick brown fox jumps over the lazy dog while the vm prints ";
+    Assembler a;
+    for (size_t page = 0; page < 400; ++page) {
+        for (size_t line = 0; line < 48; ++line) {
+            for (size_t c = 0; c < 72; ++c) {
+                a.push(static_cast<uint8_t>(words[(line * 7 + c) % (sizeof(words) - 1)]));
+                a.print();
+            }
+            a.println();
+        }
+    }
+    return make("literal_output", "400 pages of 48 lines of 72 literal characters", a, "");
+}
+
+// Sums numbers read one OP_INPUT line at a time.
+Workload inputParsing() {
+    const size_t count = 100000;
+    Assembler a;
+    a.push(0);
+    for (size_t i = 0; i < count; ++i) {
+        a.input("v");
+        a.loadVar('v');
+        a.add();
+    }
+    printNumber(a, "sum: ");
+
+    std::string input;
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < count; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        input += std::to_string((seed >> 8) % 1000000) + "\n";
+    }
+    return make("input_parsing", "read and sum 100000 decimal lines", a, input);
+}
+
+} // namespace
+
+std::vector<Workload> standardWorkloads() {
+    std::vector<Workload> workloads;
+    workloads.push_back(addChain());
+    workloads.push_back(stringBuild());
+    workloads.push_back(reportBuild());
+    workloads.push_back(compareBranch());
+    workloads.push_back(literalOutput());
+    workloads.push_back(inputParsing());
+    return workloads;
+}
@@ -0,0 +1,63 @@
+#ifndef BENCH_WORKLOADS_H
+#define BENCH_WORKLOADS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// One benchmark program: a complete DEFCAA image plus the OP_INPUT lines it
+// reads. Workloads are generated rather than shipped, so their shape and
+// size live in one place and can be re-emitted with `cvmbench --emit=DIR`.
+struct Workload {
+    std::string name;
+    std::string description;
+    std::vector<uint8_t> image; // Magic number included.
+    std::string input;
+    bool wideCells;             // Needs --cell-width=64 (counts past 255).
+};
+
+// Builds DEFCAA images with symbolic jumps. Jumps only go forward, so they
+// are emitted with a placeholder offset and patched once the target is
+// known.
+class Assembler {
+public:
+    Assembler();
+
+    size_t here() const { return bytes.size(); }
+
+    void push(uint8_t value);
+    void add();
+    void print();
+    void println();
+    void pushVar(char name, uint8_t value);
+    void loadVar(char name);
+    void printVar(char name);
+    void input(const std::string& name);
+    void loadString(const std::string& text);
+    void toString();
+    void concat();
+    void compare();
+
+    // Emit a forward jump and return its site for patch().
+    size_t jumpIfZero();
+    size_t jump();
+    // Points the jump at `site` to the current position.
+    void patch(size_t site);
+
+    const std::vector<uint8_t>& image() const { return bytes; }
+
+private:
+    void emit(uint8_t byte) { bytes.push_back(byte); }
+    size_t emitJump(uint8_t opcode, uint16_t offset);
+
+    std::vector<uint8_t> bytes;
+};
+
+// The standard suite: an add chain, string build-and-print, one large
+// string built by concatenation, compare-and-branch heavy code, large
+// literal output and input parsing. DEFCAA has no backward jumps, so each
+// workload is unrolled straight-line code.
+std::vector<Workload> standardWorkloads();
+
+#endif // BENCH_WORKLOADS_H
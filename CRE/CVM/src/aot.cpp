@@ -0,0 +1,265 @@
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "aot.h"
+#include "loader.h"
+
+static const char RUNTIME[] =
+#include "aot_runtime.inc"
+;
+
+namespace {
+
+// Writes `size` bytes as a C string literal. Octal escapes are always three
+// digits, so a following digit can never extend them.
+void quote(std::ostream& out, const char* data, size_t size) {
+    out << '"';
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\' && c != '?') {
+            out << static_cast<char>(c);
+        } else {
+            char escape[5];
+            std::snprintf(escape, sizeof(escape), "\\%03o", c);
+            out << escape;
+        }
+    }
+    out << '"';
+}
+
+// Variable names go into comments; keep only characters that cannot end one.
+std::string commentSafe(const std::string& name) {
+    std::string safe;
+    for (size_t i = 0; i < name.size(); ++i)
+        safe += std::isalnum(static_cast<unsigned char>(name[i])) || name[i] == '_' ? name[i] : '?';
+    return safe;
+}
+
+class Translator {
+public:
+    Translator(const Program& program, const RunOptions& options, std::ostream& out)
+        : program(program), options(options), out(out) {
+        // The test VirtualMachine::execute makes for a fresh context before
+        // dropping checks.
+        const Verification& verification = program.verification();
+        checked = !(verification.verified && verification.maxStackDepth <= options.stackSize);
+    }
+
+    void translate() {
+        out << "/* Generated by cvm --aot. */\n"
+            << "#define CVM_WIDE " << (options.wideCells ? 1 : 0) << '\n'
+            << "#define CVM_MASK " << (options.wideCells ? "0xFFFFFFFFFFFFFFFFull" : "0xFFull") << '\n'
+            << "#define CVM_CHECKED " << (checked ? 1 : 0) << '\n'
+            << "#define CVM_STACK_SIZE " << options.stackSize << '\n'
+            << "#define CVM_UNBUFFERED " << (options.unbuffered ? 1 : 0) << '\n'
+            << RUNTIME << '\n'
+            << "static Value stack[CVM_STACK_SIZE];\n\n"
+            << "int main(void) {\n"
+            << "    Value *sp = stack;\n"
+            << "    const Value *const limit = stack + CVM_STACK_SIZE;\n";
+        for (size_t slot = 0; slot < program.slotCount(); ++slot) {
+            out << "    Value v" << slot << " = 0;";
+            if (checked)
+                out << " int d" << slot << " = 0;";
+            out << " /* " << commentSafe(program.slotName(slot)) << " */\n";
+        }
+        out << "    (void)limit;\n"
+            << "    cvm_start();\n";
+
+        const std::vector<Instruction>& code = program.instructions();
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            out << "L" << pc << ": {";
+            instruction(code[pc]);
+            out << " }\n";
+        }
+        out << "}\n";
+    }
+
+private:
+    void require(const std::string& condition, const char* message) {
+        if (checked)
+            out << " if (!(" << condition << ")) cvm_fail(\"" << message << "\");";
+    }
+    void requireDefined(uint32_t slot, const char* message) {
+        require("d" + std::to_string(slot), message);
+    }
+    void requireRoom() { require("sp != limit", "Stack overflow detected!"); }
+    void requireDepth(int cells, const char* message) {
+        require(cells == 1 ? std::string("sp != stack") : "sp - stack >= " + std::to_string(cells), message);
+    }
+    void define(uint32_t slot) {
+        if (checked)
+            out << " d" << slot << " = 1;";
+    }
+    void jump(uint32_t target) { out << " goto L" << target << ";"; }
+
+    void print(const char* underflow) {
+        out << " if (cvm_buffer.len) cvm_print_strings(); else {";
+        requireDepth(1, underflow);
+        out << " cvm_put((char)*--sp); }";
+    }
+
+    void instruction(const Instruction& insn) {
+        switch (insn.op) {
+            case PUSH:
+                requireRoom();
+                out << " *sp++ = " << unsigned(insn.imm) << ";";
+                break;
+            case ADD:
+                requireDepth(2, "Stack underflow detected while performing ADD!");
+                out << " sp[-2] = (sp[-2] + sp[-1]) & CVM_MASK; --sp;";
+                break;
+            case PRINT:
+                print("Stack underflow detected while performing PRINT!");
+                break;
+            case PRINT_NO_NL:
+                print("Stack underflow detected while performing PRINT (no newline)!");
+                break;
+            case PRINTLN:
+                out << " cvm_println(stack, sp); sp = stack;";
+                break;
+            case PUSH_VAR:
+                out << " v" << insn.arg << " = " << unsigned(insn.imm) << ";";
+                define(insn.arg);
+                break;
+            case LOAD_VAR:
+                requireDefined(insn.arg, "Variable not defined.");
+                requireRoom();
+                out << " *sp++ = v" << insn.arg << ";";
+                break;
+            case OP_INPUT:
+                out << " v" << insn.arg << " = cvm_input();";
+                define(insn.arg);
+                break;
+            case JUMP_IF_ZERO:
+                requireDepth(1, "Stack underflow for jump condition.");
+                out << " if (*--sp == 0)";
+                jump(insn.arg);
+                break;
+            case JUMP:
+                jump(insn.arg);
+                break;
+            case PRINT_VAR:
+                requireDefined(insn.arg, "Variable not defined for PRINT_VAR.");
+                out << " cvm_write_unsigned(v" << insn.arg << ");";
+                break;
+            case OP_LOAD_STRING:
+                out << " cvm_load_string(";
+                quote(out, program.string(insn), insn.len);
+                out << ", " << insn.len << ");";
+                break;
+            case OP_TO_STRING:
+                requireDepth(1, "Stack underflow in OP_TO_STRING");
+                out << " cvm_to_string(*--sp);";
+                break;
+            case OP_CONCAT:
+                out << " cvm_concat();";
+                break;
+            case OP_COMPARE:
+                requireDepth(2, "Stack underflow in OP_COMPARE");
+                out << " sp[-2] = sp[-2] > sp[-1]; --sp;";
+                break;
+            case NOP:
+                break;
+            case OP_PRINT_LITERAL_RUN:
+                out << " sp = cvm_literal_run(";
+                quote(out, program.string(insn), insn.len);
+                out << ", " << insn.len << ", sp, limit);";
+                break;
+            case OP_COMPARE_VAR_IMM_BRANCH:
+                requireDefined(insn.len, "Variable not defined.");
+                // LOAD_VAR and PUSH each need a free cell.
+                require("limit - sp >= 2", "Stack overflow detected!");
+                out << " if (!(v" << insn.len << " > " << unsigned(insn.imm) << "))";
+                jump(insn.arg);
+                break;
+            case OP_HALT:
+                out << " return cvm_halt();";
+                break;
+            default: // OP_TRAP
+                out << " cvm_fail(\"Unsupported opcode: " << unsigned(insn.imm) << "\");";
+                break;
+        }
+    }
+
+    const Program& program;
+    const RunOptions& options;
+    std::ostream& out;
+    bool checked;
+};
+
+// Runs $CC (default cc) on `source`, fed through a pipe, writing `output`.
+void compileC(const std::string& source, const std::string& output) {
+    const char* cc = std::getenv("CC");
+    if (cc == NULL || *cc == '\0')
+        cc = "cc";
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("Failed to create a pipe for the C compiler");
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        throw std::runtime_error("Failed to start the C compiler");
+    }
+    if (pid == 0) {
+        dup2(fds[0], 0);
+        close(fds[0]);
+        close(fds[1]);
+        execlp(cc, cc, "-O2", "-w", "-x", "c", "-", "-o", output.c_str(), (char*)NULL);
+        std::fprintf(stderr, "Error: cannot run C compiler %s\n", cc);
+        _exit(127);
+    }
+    close(fds[0]);
+    // A compiler that dies early must fail the build, not kill cvm.
+    void (*previous)(int) = std::signal(SIGPIPE, SIG_IGN);
+    const char* data = source.data();
+    size_t left = source.size();
+    while (left > 0) {
+        ssize_t n = write(fds[1], data, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // The compiler exited early; its status says why.
+        data += n;
+        left -= static_cast<size_t>(n);
+    }
+    close(fds[1]);
+    std::signal(SIGPIPE, previous);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error(std::string("C compiler ") + cc + " failed to build " + output);
+}
+
+} // namespace
+
+std::string translateToC(const Program& program, const RunOptions& options) {
+    std::ostringstream out;
+    Translator(program, options, out).translate();
+    return out.str();
+}
+
+void buildExecutable(const std::string& filename, const std::string& output, const RunOptions& options) {
+    std::unique_ptr<BytecodeImage> image = openImage(filename, options);
+    if (imageMagic(*image) != CUSTOM_MAGIC)
+        throw std::runtime_error("--aot supports DEFCAA bytecode only: " + filename);
+    ProgramRef program = loadProgram(image->data() + 4, image->size() - 4, options);
+    std::string source = translateToC(*program, options);
+
+    if (output.size() >= 2 && output.compare(output.size() - 2, 2, ".c") == 0) {
+        std::ofstream file(output.c_str(), std::ios::binary);
+        file.write(source.data(), static_cast<std::streamsize>(source.size()));
+        if (!file.flush())
+            throw std::runtime_error("Failed to write " + output);
+        return;
+    }
+    compileC(source, output);
+}
@@ -0,0 +1,27 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <string>
+#include "vm.h"
+
+// Ahead-of-time translation of DEFCAA programs (cvm --aot). Every
+// instruction becomes a labelled C statement and every jump a goto, so the
+// system C compiler sees the whole control flow and no dispatch remains.
+// The output embeds a small runtime (aot_runtime.inc) for I/O and strings
+// and writes the same bytes as the interpreter.
+//
+// The run options that change behaviour are fixed at translation time:
+// cell width, stack size, --unbuffered, and fusion and verification. A
+// program that verified (with its deepest stack within the stack size) is
+// translated without stack or definedness checks. Any other program keeps
+// every check, and its errors match the interpreter's messages.
+
+// Returns the C translation of `program`.
+std::string translateToC(const Program& program, const RunOptions& options);
+
+// Loads `filename` like runVM and writes a native executable to `output`,
+// compiled with $CC (default cc). An `output` ending in ".c" receives the
+// C source instead.
+void buildExecutable(const std::string& filename, const std::string& output, const RunOptions& options);
+
+#endif // AOT_H
@@ -0,0 +1,152 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "batch.h"
+
+namespace {
+
+struct JobResult {
+    JobResult() : status(0), millis(0), done(false) {}
+    std::string out;
+    std::string err;
+    int status;
+    double millis;
+    bool done;
+};
+
+void runJob(const std::string& file, const RunOptions& options, JobResult& result) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::string noInput;
+    std::ostringstream diagnostics;
+    RunOptions job = options;
+    job.input = &noInput;
+    job.output = &result.out;
+    job.diagnostics = &diagnostics;
+    try {
+        runVM(file, job);
+    } catch (const std::exception& e) {
+        diagnostics << "Error: " << e.what() << std::endl;
+        result.status = 1;
+    }
+    result.err = diagnostics.str();
+    result.millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Copies `text` to `sink`, prefixing each line with `tag`.
+void writeTagged(OutputBuffer& sink, const std::string& tag, const std::string& text) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t newline = text.find('\n', pos);
+        size_t end = newline == std::string::npos ? text.size() : newline + 1;
+        sink.write(tag.data(), tag.size());
+        sink.write(text.data() + pos, end - pos);
+        if (newline == std::string::npos)
+            sink.put('\n');
+        pos = end;
+    }
+}
+
+} // namespace
+
+std::vector<std::string> readManifest(const std::string& manifest) {
+    std::ifstream in(manifest);
+    if (!in)
+        throw std::runtime_error("Unable to open manifest " + manifest);
+    std::vector<std::string> files;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        files.push_back(line.substr(first, last - first + 1));
+    }
+    return files;
+}
+
+int runBatch(const std::vector<std::string>& files, const RunOptions& options,
+             const BatchOptions& batch) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<JobResult> results(files.size());
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    size_t workers = batch.workers > 0 ? batch.workers : 1;
+    if (workers > files.size())
+        workers = files.size();
+    std::vector<std::thread> pool;
+    for (size_t w = 0; w < workers; ++w) {
+        pool.push_back(std::thread([&]() {
+            for (size_t i = next++; i < files.size(); i = next++) {
+                runJob(files[i], options, results[i]);
+                std::lock_guard<std::mutex> lock(mutex);
+                results[i].done = true;
+                finished.notify_one();
+            }
+        }));
+    }
+
+    // Emit on this thread while the workers run: in list order, or tagged in
+    // completion order.
+    OutputBuffer out(1);
+    OutputBuffer err(2);
+    std::vector<bool> emitted(files.size(), false);
+    size_t nextInOrder = 0;
+    for (size_t count = 0; count < files.size();) {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t i = files.size();
+        if (batch.tagged) {
+            finished.wait(lock, [&]() {
+                for (i = 0; i < files.size(); ++i) {
+                    if (results[i].done && !emitted[i])
+                        return true;
+                }
+                return false;
+            });
+        } else {
+            finished.wait(lock, [&]() { return results[nextInOrder].done; });
+            i = nextInOrder++;
+        }
+        lock.unlock();
+
+        emitted[i] = true;
+        ++count;
+        if (batch.tagged) {
+            std::string tag = "[" + files[i] + "] ";
+            writeTagged(out, tag, results[i].out);
+            writeTagged(err, tag, results[i].err);
+        } else {
+            out.write(results[i].out.data(), results[i].out.size());
+            err.write(results[i].err.data(), results[i].err.size());
+        }
+        out.flush();
+        err.flush();
+    }
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+
+    size_t failed = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        char line[64];
+        std::snprintf(line, sizeof(line), ": exit %d, %.3f ms\n", results[i].status, results[i].millis);
+        std::string report = "[batch] " + files[i] + line;
+        err.write(report.data(), report.size());
+        if (results[i].status != 0)
+            ++failed;
+    }
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    char summary[128];
+    std::snprintf(summary, sizeof(summary), "[batch] %zu jobs, %zu failed, %.3f ms on %zu workers\n",
+                  files.size(), failed, total, workers);
+    err.write(summary, std::strlen(summary));
+    err.flush();
+    return failed == 0 ? 0 : 1;
+}
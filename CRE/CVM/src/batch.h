@@ -0,0 +1,28 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "vm.h"
+
+// Options for running many bytecode files in one process (cvm -j N).
+struct BatchOptions {
+    BatchOptions() : workers(1), tagged(false) {}
+    size_t workers; // Threads running jobs.
+    bool tagged;    // Emit each job's output as it finishes, every line
+                    // prefixed with "[file] ", instead of in list order.
+};
+
+// Reads a batch manifest: one file per line; blank lines and lines starting
+// with '#' are skipped.
+std::vector<std::string> readManifest(const std::string& manifest);
+
+// Runs every file with runVM on a pool of worker threads. Each job gets its
+// own output and diagnostics buffers and an empty stdin, so jobs share no
+// streams. Per-job exit status and wall time are reported on stderr after
+// the jobs' own output. Returns 0 if every job succeeded, 1 otherwise.
+int runBatch(const std::vector<std::string>& files, const RunOptions& options,
+             const BatchOptions& batch);
+
+#endif // BATCH_H
@@ -0,0 +1,119 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "compilecache.h"
+#include "covicc.h"
+
+namespace {
+
+// 64-bit FNV-1a. Cache keys only need to be fast and well spread; the
+// source size is part of the entry name as a second guard.
+uint64_t fnv1a(const uint8_t* data, size_t size, uint64_t hash = 0xCBF29CE484222325ull) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+std::string entryName(const BytecodeImage& source) {
+    uint64_t hash = fnv1a(source.data(), source.size());
+    hash = fnv1a(reinterpret_cast<const uint8_t*>(COVICC_VERSION), std::strlen(COVICC_VERSION), hash);
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx-%llu.cb", static_cast<unsigned long long>(hash),
+                  static_cast<unsigned long long>(source.size()));
+    return name;
+}
+
+// mkdir -p with private permissions.
+bool makeDirectories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        std::string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0700) != 0 && errno != EEXIST)
+            return false;
+        if (slash == std::string::npos)
+            return true;
+    }
+}
+
+std::vector<uint8_t> compileSource(const BytecodeImage& source, const std::string& sourceFile) {
+    std::istringstream in(std::string(reinterpret_cast<const char*>(source.data()), source.size()));
+    try {
+        return compileCovi(in);
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Compiling " + sourceFile + " failed: " + e.what());
+    }
+}
+
+} // namespace
+
+CompileCache::CompileCache(const std::string& dir)
+    : dir(dir.empty() ? defaultDirectory() : dir) {}
+
+std::string CompileCache::defaultDirectory() {
+    const char* env = std::getenv("CVM_CACHE_DIR");
+    if (env != NULL && *env != '\0')
+        return env;
+    env = std::getenv("XDG_CACHE_HOME");
+    if (env != NULL && *env != '\0')
+        return std::string(env) + "/cvm";
+    env = std::getenv("HOME");
+    if (env != NULL && *env != '\0')
+        return std::string(env) + "/.cache/cvm";
+    return "/tmp/cvm-cache-" + std::to_string(getuid());
+}
+
+std::unique_ptr<BytecodeImage> CompileCache::load(const std::string& sourceFile, std::ostream* stats) {
+    BytecodeImage source(sourceFile);
+    std::string path = dir + "/" + entryName(source);
+
+    if (access(path.c_str(), R_OK) == 0) {
+        if (stats)
+            *stats << "[stats] compile cache: hit " << path << std::endl;
+        return std::unique_ptr<BytecodeImage>(new BytecodeImage(path));
+    }
+
+    std::vector<uint8_t> image = compileSource(source, sourceFile);
+    bool stored = store(path, image);
+    if (stats)
+        *stats << "[stats] compile cache: miss, " << (stored ? "stored " + path : "not stored") << std::endl;
+    return std::unique_ptr<BytecodeImage>(new BytecodeImage(std::move(image)));
+}
+
+std::unique_ptr<BytecodeImage> CompileCache::compile(const std::string& sourceFile) {
+    BytecodeImage source(sourceFile);
+    return std::unique_ptr<BytecodeImage>(new BytecodeImage(compileSource(source, sourceFile)));
+}
+
+// Writes a private temporary file and renames it into place.
+bool CompileCache::store(const std::string& path, const std::vector<uint8_t>& image) {
+    if (!makeDirectories(dir))
+        return false;
+    // Unique per process and per call, since batch jobs may compile the same
+    // source on several threads at once.
+    static std::atomic<unsigned> serial(0);
+    std::string temp = path + "." + std::to_string(getpid()) + "." + std::to_string(serial++) + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+    size_t done = 0;
+    while (done < image.size()) {
+        ssize_t n = write(fd, image.data() + done, image.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += static_cast<size_t>(n);
+    }
+    bool ok = close(fd) == 0 && done == image.size() && rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok)
+        unlink(temp.c_str());
+    return ok;
+}
@@ -0,0 +1,40 @@
+#ifndef COMPILECACHE_H
+#define COMPILECACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "loader.h"
+
+// On-disk cache of compiled .covi sources. Entries are named after a hash of
+// the source bytes and COVICC_VERSION, so an edited source or a new compiler
+// simply misses; nothing is ever invalidated in place. Misses compile
+// in-process through libcovicc and publish the image with an atomic rename,
+// so concurrent runs of the same script never see a partial entry.
+class CompileCache {
+public:
+    // An empty `dir` selects defaultDirectory().
+    explicit CompileCache(const std::string& dir);
+
+    // $CVM_CACHE_DIR, else $XDG_CACHE_HOME/cvm, else $HOME/.cache/cvm, else
+    // /tmp/cvm-cache-<uid>.
+    static std::string defaultDirectory();
+
+    // Returns the compiled image for `sourceFile`: the cached file, mapped,
+    // on a hit; freshly compiled bytes on a miss. A cache that cannot be
+    // written only costs the compile, never the run.
+    // With `stats` set, reports the hit or miss there.
+    std::unique_ptr<BytecodeImage> load(const std::string& sourceFile, std::ostream* stats);
+
+    // Compiles without looking at or writing to the cache.
+    static std::unique_ptr<BytecodeImage> compile(const std::string& sourceFile);
+
+private:
+    bool store(const std::string& path, const std::vector<uint8_t>& image);
+
+    std::string dir;
+};
+
+#endif // COMPILECACHE_H
@@ -0,0 +1,326 @@
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "jit.h"
+#include "vm.h"
+
+// Every opcode with a handler in handlers.inc.
+#define CVM_OPCODES(X) \
+    X(PUSH) X(ADD) X(PRINT) X(PRINTLN) X(PRINT_NO_NL) \
+    X(PUSH_VAR) X(LOAD_VAR) X(OP_INPUT) X(JUMP_IF_ZERO) X(JUMP) X(PRINT_VAR) \
+    X(OP_LOAD_STRING) X(OP_TO_STRING) X(OP_CONCAT) X(OP_COMPARE) X(NOP) \
+    X(OP_PRINT_LITERAL_RUN) X(OP_COMPARE_VAR_IMM_BRANCH) X(OP_HALT) X(OP_TRAP)
+
+const char* opcodeName(uint8_t op) {
+    switch (op) {
+#define X(name) case name: return #name;
+        CVM_OPCODES(X)
+#undef X
+    }
+    return "UNKNOWN";
+}
+
+const char* engineName(Engine engine) {
+    switch (engine) {
+        case ENGINE_SWITCH: return "switch";
+        case ENGINE_THREADED: return "threaded";
+        case ENGINE_REGISTER: return "register";
+    }
+    return "unknown";
+}
+
+void VirtualMachine::execute(const Program& program, Engine engine) {
+    // Slot numbers are specific to one program, so start from a clean table.
+    this->program = &program;
+    variables.assign(program.slotCount(), Variable());
+
+    // Verified programs whose deepest stack fits run with checks compiled out.
+    // The verifier starts from an empty stack and empty strings, so a context
+    // run again without reset() keeps its checks.
+    const Verification& verification = program.verification();
+    bool fresh = sp == stackBase && strBuffer.empty() && strOperand.empty();
+    bool checked = !(verification.verified && fresh &&
+                     verification.maxStackDepth <= static_cast<size_t>(stackLimit - stackBase));
+    if (profiler == NULL) {
+        if (checked)
+            dispatch<true, false>(program, engine, 0);
+        else
+            executeVerified(program, engine);
+    } else {
+        profiler->begin();
+        try {
+            if (checked)
+                dispatch<true, true>(program, engine, 0);
+            else
+                dispatch<false, true>(program, engine, 0);
+        } catch (...) {
+            profiler->finish();
+            throw;
+        }
+        profiler->finish();
+    }
+    out.flush();
+}
+
+// Verified programs may start in native code (see jit.h), which hands over
+// to the interpreter on the same stack and variables where it stops.
+void VirtualMachine::executeVerified(const Program& program, Engine engine) {
+    // Only reached from the fresh state the verifier started from (see
+    // execute()), which the IR assumes too.
+    if (engine == ENGINE_REGISTER && jitMode == JIT_OFF && program.registerCode() != NULL) {
+        executeRegisters(program);
+        return;
+    }
+
+    size_t pc = 0;
+    if (jitMode == JIT_FORCE && compileJit(program))
+        pc = runJit(pc);
+    dispatch<false, false>(program, engine, pc);
+}
+
+// Register engine: runs the register IR of a verified program (regir.h).
+// Variables and stack cells share one register file, the variable slots
+// followed by one register per stack depth.
+void VirtualMachine::executeRegisters(const Program& program) {
+    const RegisterCode& ir = *program.registerCode();
+    variables.resize(ir.registerCount);
+    Variable* r = variables.data();
+    const RegisterInstruction* code = ir.code.data();
+    const RegisterInstruction* insn = code;
+
+#define R_SET(reg, v) do { r[reg].value = (v); r[reg].defined = true; } while (0)
+
+    for (;; ++insn) {
+        switch (insn->op) {
+            case R_MOV:   R_SET(insn->dst, r[insn->a].value); break;
+            case R_MOVI:  R_SET(insn->dst, insn->b); break;
+            case R_ADD:   R_SET(insn->dst, (r[insn->a].value + r[insn->b].value) & valueMask); break;
+            case R_ADDI:  R_SET(insn->dst, (r[insn->a].value + insn->b) & valueMask); break;
+            case R_GT:    R_SET(insn->dst, r[insn->a].value > r[insn->b].value ? 1 : 0); break;
+            case R_GTI:   R_SET(insn->dst, r[insn->a].value > insn->b ? 1 : 0); break;
+            case R_LTI:   R_SET(insn->dst, r[insn->a].value < insn->b ? 1 : 0); break;
+            case R_JMP:
+                insn = code + insn->dst - 1;
+                break;
+            case R_JZ:
+                if (r[insn->a].value == 0)
+                    insn = code + insn->dst - 1;
+                break;
+            case R_JLE:
+                if (!(r[insn->a].value > r[insn->b].value))
+                    insn = code + insn->dst - 1;
+                break;
+            case R_JLEI:
+                if (!(r[insn->a].value > insn->b))
+                    insn = code + insn->dst - 1;
+                break;
+            case R_JGEI:
+                if (!(insn->b > r[insn->a].value))
+                    insn = code + insn->dst - 1;
+                break;
+            case R_PUT:   out.put(static_cast<char>(r[insn->a].value)); break;
+            case R_PUTI:  out.put(static_cast<char>(insn->b)); break;
+            case R_PRINT_STRINGS:
+                printStrings();
+                break;
+            case R_PRINTLN:
+                if (!strBuffer.empty())
+                    printStrings();
+                for (uint32_t i = 0; i < insn->b; ++i)
+                    out.put(static_cast<char>(r[insn->a + i].value));
+                out.newline();
+                break;
+            case R_PRINT_VAR:
+                out.writeUnsigned(r[insn->a].value);
+                break;
+            case R_INPUT:
+                R_SET(insn->dst, readInputValue());
+                break;
+            case R_LOAD_STRING:
+                strBuffer.assignLiteral(program.string(insn->a), insn->b);
+                break;
+            case R_TO_STRING:
+                strOperand.assignNumber(r[insn->a].value);
+                break;
+            case R_TO_STRINGI:
+                strOperand.assignNumber(insn->b);
+                break;
+            case R_CONCAT:
+                strBuffer.append(strOperand);
+                break;
+            case R_WRITE:
+                out.write(program.string(insn->a), insn->b);
+                break;
+            case R_HALT:
+                // Whatever is left on the stack is visible afterwards, as
+                // with the stack engines.
+                for (uint32_t i = 0; i < insn->b; ++i)
+                    *sp++ = r[insn->a + i].value;
+                variables.resize(program.slotCount());
+                return;
+        }
+    }
+
+#undef R_SET
+}
+
+bool VirtualMachine::compileJit(const Program& program) {
+    if (jitGeneration != program.generation()) {
+        jitCode = JitCode::compile(program);
+        jitGeneration = program.generation();
+    }
+    return jitCode != NULL;
+}
+
+// Runs native code from `pc` and returns where the interpreter resumes.
+size_t VirtualMachine::runJit(size_t pc) {
+    JitFrame frame;
+    frame.sp = sp;
+    frame.vars = variables.data();
+    frame.vm = this;
+    frame.mask = valueMask;
+    pc = jitCode->run(frame, pc);
+    sp = frame.sp;
+    if (jitError) {
+        std::exception_ptr error = jitError;
+        jitError = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+    return pc;
+}
+
+// Called from native code for opcodes the JIT does not translate. Exceptions
+// cannot unwind through generated code, so they are parked in jitError and
+// a non-zero return makes the code exit.
+int VirtualMachine::jitStep(JitFrame* frame, const Instruction* insn) {
+    VirtualMachine* vm = frame->vm;
+    vm->sp = frame->sp;
+    try {
+        vm->executeOne(insn);
+    } catch (...) {
+        vm->jitError = std::current_exception();
+        frame->sp = vm->sp;
+        return 1;
+    }
+    frame->sp = vm->sp;
+    return 0;
+}
+
+// Runs a single non-branching instruction through the shared handlers, as
+// the unchecked engines would.
+void VirtualMachine::executeOne(const Instruction* insn) {
+    const bool Checked = false;
+    const bool Profiled = false;
+    const Program& program = *this->program;
+
+#define VM_CASE(op) case op:
+#define VM_NEXT return
+#define VM_JUMP(t) return
+
+    switch (insn->op) {
+#include "handlers.inc"
+        default:
+            throw std::runtime_error("Unsupported opcode: " + std::to_string(insn->op));
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+}
+
+template <bool Checked, bool Profiled>
+void VirtualMachine::dispatch(const Program& program, Engine engine, size_t start) {
+    if (engine == ENGINE_THREADED)
+        executeThreaded<Checked, Profiled>(program, start);
+    else
+        executeSwitch<Checked, Profiled>(program, start);
+}
+
+// Reference engine: one switch shared by every opcode.
+template <bool Checked, bool Profiled>
+void VirtualMachine::executeSwitch(const Program& program, size_t start) {
+    const Instruction* code = program.instructions().data();
+    const Instruction* insn;
+    size_t pc = start;
+
+#define VM_CASE(op) case op:
+#define VM_NEXT continue
+#define VM_JUMP(t) { pc = (t); VM_NEXT; }
+
+    for (;;) {
+        insn = &code[pc++];
+        if (Profiled)
+            profiler->step(pc - 1, insn->op);
+        switch (insn->op) {
+#include "handlers.inc"
+            default:
+                throw std::runtime_error("Unsupported opcode: " + std::to_string(insn->op));
+        }
+    }
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+}
+
+#if CVM_HAVE_THREADED_DISPATCH
+
+namespace {
+
+// Handler address for every byte value, the threaded engine's dispatch table.
+struct DispatchTable {
+    void* at[256];
+};
+
+DispatchTable makeDispatchTable(void* trap, std::initializer_list<std::pair<uint8_t, void*> > handlers) {
+    DispatchTable table;
+    for (size_t i = 0; i < 256; ++i)
+        table.at[i] = trap;
+    for (const std::pair<uint8_t, void*>& handler : handlers)
+        table.at[handler.first] = handler.second;
+    return table;
+}
+
+} // namespace
+
+// Threaded engine: each handler ends in its own indirect jump, so the branch
+// predictor sees one dispatch site per opcode instead of a single shared one.
+template <bool Checked, bool Profiled>
+void VirtualMachine::executeThreaded(const Program& program, size_t start) {
+    const Instruction* code = program.instructions().data();
+    const Instruction* insn;
+    size_t pc = start;
+
+    // Label addresses only exist inside this function, so the table is
+    // built on the first call, once per instantiation.
+#define X(op) { op, &&L_##op },
+    static const DispatchTable labels = makeDispatchTable(&&L_OP_TRAP, { CVM_OPCODES(X) });
+#undef X
+
+#define VM_CASE(op) L_##op:
+#define VM_NEXT do { \
+        insn = &code[pc++]; \
+        if (Profiled) profiler->step(pc - 1, insn->op); \
+        goto *labels.at[insn->op]; \
+    } while (0)
+#define VM_JUMP(t) { pc = (t); VM_NEXT; }
+
+    VM_NEXT;
+#include "handlers.inc"
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+}
+
+#else
+
+template <bool Checked, bool Profiled>
+void VirtualMachine::executeThreaded(const Program& program, size_t start) {
+    // Labels-as-values unavailable: fall back to the reference engine.
+    executeSwitch<Checked, Profiled>(program, start);
+}
+
+#endif
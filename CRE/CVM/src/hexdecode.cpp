@@ -0,0 +1,165 @@
+#include <stdexcept>
+#include <string>
+#include "hexdecode.h"
+#include "hexdecode_impl.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool isHexDigit(uint8_t c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+}
+
+bool isSpace(uint8_t c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+uint8_t hexValue(uint8_t c) {
+    if (c <= '9')
+        return c - '0';
+    return (c | 0x20) - 'a' + 10;
+}
+
+// Byte-at-a-time decoder. Finishes whatever the vector kernels left, and
+// decodes everything on machines without them.
+HexResult finishScalar(HexCursor& c, size_t* written, uint8_t* outStart) {
+    std::string error; // First malformed byte; reported only if the input is hex.
+    for (size_t i = c.pos; i < c.size; ++i) {
+        uint8_t b = c.in[i];
+        if (isSpace(b)) {
+            c.inToken = false;
+            continue;
+        }
+        bool isX = (b | 0x20) == 'x';
+        if (!isHexDigit(b) && !isX)
+            return HEX_NOT_HEX;
+        if (!error.empty())
+            continue;
+        if (c.skipX) {
+            c.skipX = false;
+            c.inToken = true;
+            continue;
+        }
+        if (!c.inToken && b == '0' && i + 1 < c.size && (c.in[i + 1] | 0x20) == 'x') {
+            c.skipX = true;
+            c.inToken = true;
+            continue;
+        }
+        c.inToken = true;
+        if (isX) {
+            error = "Invalid ASCII hex bytecode: stray '" + std::string(1, static_cast<char>(b)) +
+                    "' at byte " + std::to_string(i);
+            continue;
+        }
+        if (c.high < 0) {
+            c.high = hexValue(b);
+        } else {
+            *c.out++ = static_cast<uint8_t>((c.high << 4) | hexValue(b));
+            c.high = -1;
+        }
+    }
+    if (!error.empty())
+        throw std::runtime_error(error);
+    if (c.high >= 0)
+        throw std::runtime_error("Invalid ASCII hex bytecode: odd length");
+    *written = static_cast<size_t>(c.out - outStart);
+    return HEX_DECODED;
+}
+
+typedef void (*HexKernel)(HexCursor&);
+
+struct HexImplementation {
+    HexKernel kernel;
+    const char* name;
+};
+
+HexImplementation selectImplementation() {
+    HexImplementation impl = { NULL, "scalar" };
+#if defined(__SSE2__)
+    impl.kernel = hexKernelSse2;
+    impl.name = "sse2";
+#endif
+#if defined(CVM_HAVE_AVX2_KERNEL)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl.kernel = hexKernelAvx2;
+        impl.name = "avx2";
+    }
+#endif
+    return impl;
+}
+
+const HexImplementation& implementation() {
+    static const HexImplementation impl = selectImplementation();
+    return impl;
+}
+
+} // namespace
+
+#if defined(__SSE2__)
+
+// 16 bytes per step. Signed compares are fine for the ranges below because
+// bytes >= 0x80 compare as negative and fall outside all of them.
+void hexKernelSse2(HexCursor& c) {
+    const __m128i zero = _mm_setzero_si128();
+    while (c.pos + 16 + 1 <= c.size) {
+        const uint8_t* p = c.in + c.pos;
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+
+        __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                        _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+        __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+        __m128i isSpace = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                       _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                                     _mm_cmpgt_epi8(_mm_set1_epi8('\r' + 1), v)));
+
+        HexMasks m;
+        m.digit = _mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha));
+        m.space = _mm_movemask_epi8(isSpace);
+        m.x = _mm_movemask_epi8(_mm_cmpeq_epi8(lower, _mm_set1_epi8('x')));
+        m.zero = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('0')));
+        m.xNext = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(next, _mm_set1_epi8(0x20)),
+                                                   _mm_set1_epi8('x')));
+        uint32_t keep;
+        if (!planHexChunk(c, m, 16, &keep))
+            return;
+
+        // '0'-'9' already have bit 5 set, so lower - '0' is right for digits;
+        // letters need another 39 off to land on 10-15.
+        __m128i nibbles = _mm_sub_epi8(_mm_sub_epi8(lower, _mm_set1_epi8('0')),
+                                       _mm_and_si128(isAlpha, _mm_set1_epi8(39)));
+        if (keep == 0xFFFF && c.high < 0) {
+            // Sixteen digits in a row: pair them in 16-bit lanes and narrow.
+            __m128i hi = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+            __m128i lo = _mm_srli_epi16(nibbles, 8);
+            __m128i bytes = _mm_packus_epi16(_mm_or_si128(hi, lo), zero);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(c.out), bytes);
+            c.out += 8;
+        } else {
+            uint8_t lanes[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), nibbles);
+            emitHexNibbles(c, keep, lanes);
+        }
+        c.pos += 16;
+    }
+}
+
+#endif
+
+HexResult decodeAsciiHex(const uint8_t* in, size_t size, uint8_t* out, size_t* written) {
+    HexCursor c = { in, 0, size, out, -1, false, false };
+    HexKernel kernel = implementation().kernel;
+    if (kernel != NULL)
+        kernel(c);
+    return finishScalar(c, written, out);
+}
+
+const char* hexDecoderName() {
+    return implementation().name;
+}
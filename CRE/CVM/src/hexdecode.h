@@ -0,0 +1,27 @@
+#ifndef HEXDECODE_H
+#define HEXDECODE_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Outcome of decodeAsciiHex().
+enum HexResult {
+    HEX_DECODED, // The input was ASCII hex and `out` holds the bytes.
+    HEX_NOT_HEX  // The input contains a byte that cannot appear in ASCII hex.
+};
+
+// Decodes an ASCII hex image in one pass: whitespace separates tokens, a
+// leading "0x"/"0X" on a token is skipped, and the remaining digits are read
+// in pairs across tokens. `out` must have room for size / 2 bytes; the number
+// of bytes written is stored in *written. Inputs made only of hex digits,
+// whitespace and 'x'/'X' that are still malformed (odd digit count, an 'x'
+// outside a prefix) throw std::runtime_error.
+//
+// Classification and nibble conversion use AVX2 when the CPU has it, SSE2 on
+// other x86-64 machines, and a scalar loop elsewhere.
+HexResult decodeAsciiHex(const uint8_t* in, size_t size, uint8_t* out, size_t* written);
+
+// "avx2", "sse2" or "scalar": the implementation decodeAsciiHex() uses here.
+const char* hexDecoderName();
+
+#endif // HEXDECODE_H
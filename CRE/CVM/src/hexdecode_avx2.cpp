@@ -0,0 +1,52 @@
+// AVX2 hex decoder kernel. This file alone is compiled with -mavx2;
+// hexdecode.cpp only calls into it after checking the CPU supports AVX2.
+
+#include <immintrin.h>
+#include "hexdecode_impl.h"
+
+// Same classification as hexKernelSse2, 32 bytes per step.
+void hexKernelAvx2(HexCursor& c) {
+    const __m256i zero = _mm256_setzero_si256();
+    while (c.pos + 32 + 1 <= c.size) {
+        const uint8_t* p = c.in + c.pos;
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+
+        __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i isAlpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+        __m256i isSpace = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                          _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v)));
+
+        HexMasks m;
+        m.digit = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)));
+        m.space = static_cast<uint32_t>(_mm256_movemask_epi8(isSpace));
+        m.x = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('x'))));
+        m.zero = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('0'))));
+        m.xNext = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_or_si256(next, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('x'))));
+        uint32_t keep;
+        if (!planHexChunk(c, m, 32, &keep))
+            return;
+
+        __m256i nibbles = _mm256_sub_epi8(_mm256_sub_epi8(lower, _mm256_set1_epi8('0')),
+                                          _mm256_and_si256(isAlpha, _mm256_set1_epi8(39)));
+        if (keep == 0xFFFFFFFFu && c.high < 0) {
+            __m256i hi = _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0x00FF)), 4);
+            __m256i lo = _mm256_srli_epi16(nibbles, 8);
+            // packus works per 128-bit lane; gather the two low quadwords.
+            __m256i bytes = _mm256_packus_epi16(_mm256_or_si256(hi, lo), zero);
+            bytes = _mm256_permute4x64_epi64(bytes, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(c.out), _mm256_castsi256_si128(bytes));
+            c.out += 16;
+        } else {
+            uint8_t lanes[32];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), nibbles);
+            emitHexNibbles(c, keep, lanes);
+        }
+        c.pos += 32;
+    }
+}
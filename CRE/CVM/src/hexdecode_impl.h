@@ -0,0 +1,82 @@
+#ifndef HEXDECODE_IMPL_H
+#define HEXDECODE_IMPL_H
+
+// Internals shared by the scalar, SSE2 and AVX2 hex decoders. Only
+// hexdecode.cpp and hexdecode_avx2.cpp include this file.
+
+#include <cstdint>
+#include <cstddef>
+
+// Decoder position and the state carried between chunks.
+struct HexCursor {
+    const uint8_t* in;
+    size_t pos;
+    size_t size;
+    uint8_t* out;
+    int high;     // Pending first digit of a pair, or -1.
+    bool inToken; // The byte before `pos` is not whitespace.
+    bool skipX;   // The byte at `pos` is the 'x' of a "0x" prefix.
+};
+
+// Vector kernels. Each consumes whole chunks while they are well-formed hex
+// and leaves the cursor at the first chunk it cannot handle; the scalar
+// loop in hexdecode.cpp finishes from there.
+void hexKernelSse2(HexCursor& c);
+void hexKernelAvx2(HexCursor& c);
+
+// Internal linkage on purpose: hexdecode_avx2.cpp is compiled with -mavx2,
+// and a shared inline definition could otherwise end up in SSE2-only code.
+namespace {
+
+// Byte-class bitmasks for one chunk, bit i describing byte pos + i.
+struct HexMasks {
+    uint32_t digit; // 0-9, a-f, A-F
+    uint32_t space; // ' ', \t, \n, \v, \f, \r
+    uint32_t x;     // 'x' or 'X'
+    uint32_t zero;  // '0'
+    uint32_t xNext; // Byte pos + i + 1 is 'x' or 'X'.
+};
+
+// Works out which digits of a chunk of `width` bytes are kept and updates the
+// carried token state. Returns false, leaving the cursor untouched, if the
+// chunk has a byte outside the hex alphabet or an 'x' that is not part of a
+// token-leading "0x".
+inline bool planHexChunk(HexCursor& c, const HexMasks& m, unsigned width, uint32_t* keep) {
+    const uint32_t all = width == 32 ? 0xFFFFFFFFu : (1u << width) - 1;
+    if ((m.digit | m.space | m.x) != all)
+        return false;
+
+    uint32_t nonSpace = ~m.space & all;
+    uint32_t tokenStart = nonSpace & ~((nonSpace << 1) | (c.inToken ? 1u : 0u));
+    uint32_t prefixZero = tokenStart & m.zero & m.xNext;
+    uint32_t prefixX = ((prefixZero << 1) & all) | (c.skipX ? 1u : 0u);
+    if (m.x & ~prefixX)
+        return false;
+
+    *keep = m.digit & ~prefixZero;
+    c.inToken = (nonSpace >> (width - 1)) & 1;
+    c.skipX = (prefixZero >> (width - 1)) & 1;
+    return true;
+}
+
+// Appends the kept nibbles of a chunk, pairing them across chunk boundaries.
+inline void emitHexNibbles(HexCursor& c, uint32_t keep, const uint8_t* nibbles) {
+    uint8_t* out = c.out;
+    int high = c.high;
+    while (keep != 0) {
+        unsigned i = __builtin_ctz(keep);
+        keep &= keep - 1;
+        if (high < 0) {
+            high = nibbles[i];
+        } else {
+            *out++ = static_cast<uint8_t>((high << 4) | nibbles[i]);
+            high = -1;
+        }
+    }
+    c.out = out;
+    c.high = high;
+}
+
+} // namespace
+
+#endif // HEXDECODE_IMPL_H
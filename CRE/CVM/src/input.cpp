@@ -0,0 +1,62 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "input.h"
+
+InputSource::InputSource(int fd)
+    : fd(fd), text(NULL), textPos(0), start(0), end(0), eof(false) {}
+
+void InputSource::readFrom(const std::string* text) {
+    this->text = text;
+    textPos = 0;
+}
+
+bool InputSource::readLine(std::string& line) {
+    line.clear();
+    if (text != NULL) {
+        if (textPos >= text->size())
+            return false;
+        size_t newline = text->find('\n', textPos);
+        if (newline == std::string::npos)
+            newline = text->size();
+        line.assign(*text, textPos, newline - textPos);
+        textPos = newline + 1;
+        return true;
+    }
+
+    bool any = false;
+    for (;;) {
+        if (start == end && !fill())
+            return any;
+        any = true;
+        const char* data = &buffer[start];
+        const char* newline = static_cast<const char*>(std::memchr(data, '\n', end - start));
+        if (newline != NULL) {
+            line.append(data, newline);
+            start += static_cast<size_t>(newline - data) + 1;
+            return true;
+        }
+        line.append(data, end - start);
+        start = end;
+    }
+}
+
+// Refills the buffer from fd; false once the descriptor is exhausted.
+bool InputSource::fill() {
+    if (eof)
+        return false;
+    if (buffer.empty())
+        buffer.resize(4096);
+    start = end = 0;
+    for (;;) {
+        ssize_t n = ::read(fd, &buffer[0], buffer.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            eof = true; // Like std::cin, a failed read is end of input.
+            return false;
+        }
+        end = static_cast<size_t>(n);
+        return true;
+    }
+}
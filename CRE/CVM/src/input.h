@@ -0,0 +1,39 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Line reader behind OP_INPUT, owned by a VirtualMachine like its
+// OutputBuffer. It reads a file descriptor (stdin by default) through its
+// own buffer, or serves the lines of a string, so VMs never share std::cin.
+class InputSource {
+public:
+    explicit InputSource(int fd = 0);
+
+    // Serves lines from `text` instead of the file descriptor. The string
+    // must outlive the reads.
+    void readFrom(const std::string* text);
+
+    // Reads the next line without its '\n'. At end of input the line is
+    // left empty and false is returned, like std::getline on a failed
+    // stream.
+    bool readLine(std::string& line);
+
+private:
+    InputSource(const InputSource&);
+    InputSource& operator=(const InputSource&);
+
+    bool fill();
+
+    int fd;
+    const std::string* text;
+    size_t textPos;
+    std::vector<char> buffer; // Allocated on first read from fd.
+    size_t start;             // Unread bytes are buffer[start, end).
+    size_t end;
+    bool eof;
+};
+
+#endif // INPUT_H
@@ -0,0 +1,248 @@
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include "jit.h"
+#include "program.h"
+
+#if CVM_HAVE_JIT
+
+#include <sys/mman.h>
+
+namespace {
+
+static_assert(offsetof(JitFrame, sp) == 0 && offsetof(JitFrame, vars) == 8 &&
+              offsetof(JitFrame, vm) == 16 && offsetof(JitFrame, mask) == 24,
+              "generated code depends on the JitFrame layout");
+static_assert(sizeof(VirtualMachine::Variable) == 16 && offsetof(VirtualMachine::Variable, defined) == 8,
+              "generated code depends on the Variable layout");
+
+// Native code entry: size_t (*)(JitFrame* frame, const uint8_t* entry).
+typedef size_t (*NativeEntry)(JitFrame*, const uint8_t*);
+
+// x86-64 machine code for one program. Registers while it runs:
+//   rbx  operand stack pointer (JitFrame::sp), next free cell
+//   r12  variable slots
+//   r13  value mask
+//   r14  the JitFrame
+// All four are callee-saved, so helper calls leave them intact.
+class Emitter {
+public:
+    // `helper` is the address of VirtualMachine::jitStep.
+    Emitter(const Program& program, uint64_t helper) : program(program), helper(helper), exitLabel(0) {}
+
+    std::vector<uint8_t> translate(std::vector<uint32_t>& entries) {
+        const std::vector<Instruction>& code = program.instructions();
+        prologue();
+        entries.resize(code.size());
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            entries[pc] = static_cast<uint32_t>(bytes.size());
+            instruction(pc, code[pc]);
+        }
+        // Shared epilogue; every exit jumps here with the resume pc in eax.
+        exitLabel = bytes.size();
+        epilogue();
+
+        for (size_t i = 0; i < fixups.size(); ++i) {
+            size_t target = fixups[i].toExit ? exitLabel : entries[fixups[i].pc];
+            patch32(fixups[i].at, static_cast<int32_t>(target - (fixups[i].at + 4)));
+        }
+        return bytes;
+    }
+
+private:
+    struct Fixup {
+        size_t at;   // Offset of a rel32 operand.
+        size_t pc;   // Target instruction.
+        bool toExit; // Targets the epilogue instead.
+    };
+
+    void emit(std::initializer_list<uint8_t> code) { bytes.insert(bytes.end(), code); }
+    void emit32(uint32_t value) {
+        for (int i = 0; i < 4; ++i)
+            bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    void emit64(uint64_t value) {
+        emit32(static_cast<uint32_t>(value));
+        emit32(static_cast<uint32_t>(value >> 32));
+    }
+    void patch32(size_t at, int32_t value) {
+        uint32_t v = static_cast<uint32_t>(value);
+        for (int i = 0; i < 4; ++i)
+            bytes[at + i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+    void branchTo(size_t pc) {
+        Fixup f = { bytes.size(), pc, false };
+        fixups.push_back(f);
+        emit32(0);
+    }
+    void exitWith(size_t pc) {
+        emit({ 0xB8 }); emit32(static_cast<uint32_t>(pc));     // mov eax, pc
+        emit({ 0xE9 });                                        // jmp exit
+        Fixup f = { bytes.size(), 0, true };
+        fixups.push_back(f);
+        emit32(0);
+    }
+    static uint32_t slotOffset(uint32_t slot) { return slot * 16; }
+
+    void prologue() {
+        emit({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }); // push rbx, rbp, r12-r15
+        emit({ 0x48, 0x83, 0xEC, 0x08 });                                      // sub rsp, 8 (align calls)
+        emit({ 0x49, 0x89, 0xFE });                                            // mov r14, rdi
+        emit({ 0x49, 0x8B, 0x1E });                                            // mov rbx, [r14]
+        emit({ 0x4D, 0x8B, 0x66, 0x08 });                                      // mov r12, [r14+8]
+        emit({ 0x4D, 0x8B, 0x6E, 0x18 });                                      // mov r13, [r14+24]
+        emit({ 0xFF, 0xE6 });                                                  // jmp rsi
+    }
+
+    void epilogue() {
+        emit({ 0x49, 0x89, 0x1E });                                            // mov [r14], rbx
+        emit({ 0x48, 0x83, 0xC4, 0x08 });                                      // add rsp, 8
+        emit({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B }); // pop r15-r12, rbp, rbx
+        emit({ 0xC3 });                                                        // ret
+    }
+
+    void pushRax() {
+        emit({ 0x48, 0x89, 0x03 });                  // mov [rbx], rax
+        emit({ 0x48, 0x83, 0xC3, 0x08 });            // add rbx, 8
+    }
+
+    void markDefined(uint32_t slot) {
+        emit({ 0x41, 0xC6, 0x84, 0x24 });            // mov byte [r12+slot+8], 1
+        emit32(slotOffset(slot) + 8);
+        emit({ 0x01 });
+    }
+
+    // Everything else goes through VirtualMachine::jitStep.
+    void helperCall(size_t pc, const Instruction& insn) {
+        emit({ 0x49, 0x89, 0x1E });                  // mov [r14], rbx
+        emit({ 0x4C, 0x89, 0xF7 });                  // mov rdi, r14
+        emit({ 0x48, 0xBE });                        // mov rsi, &insn
+        emit64(reinterpret_cast<uint64_t>(&insn));
+        emit({ 0x48, 0xB8 });                        // mov rax, jitStep
+        emit64(helper);
+        emit({ 0xFF, 0xD0 });                        // call rax
+        emit({ 0x49, 0x8B, 0x1E });                  // mov rbx, [r14]
+        emit({ 0x85, 0xC0 });                        // test eax, eax
+        emit({ 0x74, 0x0A });                        // jz past the exit below
+        exitWith(pc);                                // 10 bytes
+    }
+
+    void instruction(size_t pc, const Instruction& insn) {
+        switch (insn.op) {
+            case PUSH:
+                emit({ 0x48, 0xC7, 0x03 });          // mov qword [rbx], imm
+                emit32(insn.imm);
+                emit({ 0x48, 0x83, 0xC3, 0x08 });    // add rbx, 8
+                break;
+            case ADD:
+                emit({ 0x48, 0x8B, 0x43, 0xF8 });    // mov rax, [rbx-8]
+                emit({ 0x48, 0x03, 0x43, 0xF0 });    // add rax, [rbx-16]
+                emit({ 0x4C, 0x21, 0xE8 });          // and rax, r13
+                emit({ 0x48, 0x89, 0x43, 0xF0 });    // mov [rbx-16], rax
+                emit({ 0x48, 0x83, 0xEB, 0x08 });    // sub rbx, 8
+                break;
+            case PUSH_VAR:
+                emit({ 0x49, 0xC7, 0x84, 0x24 });    // mov qword [r12+slot], imm
+                emit32(slotOffset(insn.arg));
+                emit32(insn.imm);
+                markDefined(insn.arg);
+                break;
+            case LOAD_VAR:
+                emit({ 0x49, 0x8B, 0x84, 0x24 });    // mov rax, [r12+slot]
+                emit32(slotOffset(insn.arg));
+                pushRax();
+                break;
+            case OP_COMPARE:
+                emit({ 0x31, 0xC9 });                // xor ecx, ecx
+                emit({ 0x48, 0x8B, 0x43, 0xF0 });    // mov rax, [rbx-16]
+                emit({ 0x48, 0x3B, 0x43, 0xF8 });    // cmp rax, [rbx-8]
+                emit({ 0x0F, 0x97, 0xC1 });          // seta cl
+                emit({ 0x48, 0x89, 0x4B, 0xF0 });    // mov [rbx-16], rcx
+                emit({ 0x48, 0x83, 0xEB, 0x08 });    // sub rbx, 8
+                break;
+            case JUMP_IF_ZERO:
+                emit({ 0x48, 0x83, 0xEB, 0x08 });    // sub rbx, 8
+                emit({ 0x48, 0x83, 0x3B, 0x00 });    // cmp qword [rbx], 0
+                emit({ 0x0F, 0x84 });                // je target
+                branchTo(insn.arg);
+                break;
+            case JUMP:
+                emit({ 0xE9 });                      // jmp target
+                branchTo(insn.arg);
+                break;
+            case OP_COMPARE_VAR_IMM_BRANCH:
+                emit({ 0x49, 0x8B, 0x84, 0x24 });    // mov rax, [r12+slot]
+                emit32(slotOffset(insn.len));
+                emit({ 0x48, 0x3D });                // cmp rax, imm
+                emit32(insn.imm);
+                emit({ 0x0F, 0x86 });                // jbe target (not greater, unsigned)
+                branchTo(insn.arg);
+                break;
+            case NOP:
+                break;
+            case OP_HALT:
+            case OP_TRAP:
+                // The interpreter finishes the run, or raises the error.
+                exitWith(pc);
+                break;
+            default:
+                helperCall(pc, insn);
+                break;
+        }
+    }
+
+    const Program& program;
+    uint64_t helper;
+    std::vector<uint8_t> bytes;
+    std::vector<Fixup> fixups;
+    size_t exitLabel;
+};
+
+} // namespace
+
+std::unique_ptr<JitCode> JitCode::compile(const Program& program) {
+    if (!program.verification().verified)
+        return std::unique_ptr<JitCode>();
+    std::vector<uint32_t> entries;
+    Emitter emitter(program, reinterpret_cast<uint64_t>(&VirtualMachine::jitStep));
+    std::vector<uint8_t> code = emitter.translate(entries);
+
+    // Written while writable, then flipped to read+execute: never both.
+    void* memory = mmap(NULL, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return std::unique_ptr<JitCode>();
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.size());
+        return std::unique_ptr<JitCode>();
+    }
+    return std::unique_ptr<JitCode>(new JitCode(static_cast<uint8_t*>(memory), code.size(), entries));
+}
+
+JitCode::JitCode(uint8_t* memory, size_t size, std::vector<uint32_t>& entries)
+    : memory(memory), size(size) {
+    this->entries.swap(entries);
+}
+
+JitCode::~JitCode() {
+    munmap(memory, size);
+}
+
+size_t JitCode::run(JitFrame& frame, size_t pc) const {
+    NativeEntry entry = reinterpret_cast<NativeEntry>(memory);
+    return entry(&frame, memory + entries[pc]);
+}
+
+#else
+
+std::unique_ptr<JitCode> JitCode::compile(const Program&) {
+    return std::unique_ptr<JitCode>();
+}
+
+JitCode::~JitCode() {}
+
+size_t JitCode::run(JitFrame&, size_t pc) const {
+    return pc;
+}
+
+#endif
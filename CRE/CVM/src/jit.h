@@ -0,0 +1,57 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "vm.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define CVM_HAVE_JIT 1
+#else
+#define CVM_HAVE_JIT 0
+#endif
+
+// Machine state shared between a VirtualMachine and its native code. The
+// generated code addresses these fields by offset, so their order is fixed.
+struct JitFrame {
+    Value* sp;                          // Next free stack cell; kept in rbx while native code runs.
+    VirtualMachine::Variable* vars;     // Variable slots; r12.
+    VirtualMachine* vm;                 // Passed to helpers.
+    Value mask;                         // 0xFF or all ones; r13.
+};
+
+// Baseline template JIT: every instruction of a verified Program becomes a
+// fixed x86-64 sequence operating directly on the VM's stack and variable
+// slots, so native code and the interpreter can hand over at any pc.
+//
+// Stack, variable, arithmetic, compare and branch opcodes are translated
+// inline. Output, input and string opcodes call VirtualMachine::jitStep,
+// which runs the interpreter's own handler for that one instruction.
+// Opcodes with neither (OP_TRAP) leave native code and resume the
+// interpreter at that pc, as does OP_HALT.
+class JitCode {
+public:
+    // Returns NULL when the platform has no JIT or the program was not
+    // verified: native code runs without stack or definedness checks.
+    static std::unique_ptr<JitCode> compile(const Program& program);
+    ~JitCode();
+
+    // Runs from instruction `pc` until native code exits; returns the pc at
+    // which the interpreter takes over. `frame.sp` is updated.
+    size_t run(JitFrame& frame, size_t pc) const;
+
+    size_t codeSize() const { return size; }
+
+private:
+    JitCode(uint8_t* memory, size_t size, std::vector<uint32_t>& entries);
+    JitCode(const JitCode&);
+    JitCode& operator=(const JitCode&);
+
+    uint8_t* memory;              // Executable mapping.
+    size_t size;
+    std::vector<uint32_t> entries; // Instruction index -> offset of its code.
+};
+
+#endif // JIT_H
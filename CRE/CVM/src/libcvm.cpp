@@ -0,0 +1,24 @@
+#include <stdexcept>
+#include "libcvm.h"
+#include "loader.h"
+
+namespace cvm {
+
+ProgramRef loadFile(const std::string& filename, const Options& options) {
+    std::unique_ptr<BytecodeImage> image = openImage(filename, options);
+    return loadImage(image->data(), image->size(), options);
+}
+
+ProgramRef loadImage(const uint8_t* image, size_t size, const Options& options) {
+    if (size < 4)
+        throw std::runtime_error("Bytecode image too small to contain magic number");
+    uint32_t magic = (static_cast<uint32_t>(image[0]) << 24) |
+                     (static_cast<uint32_t>(image[1]) << 16) |
+                     (static_cast<uint32_t>(image[2]) << 8)  |
+                     (static_cast<uint32_t>(image[3]));
+    if (magic != CUSTOM_MAGIC)
+        throw std::runtime_error("Invalid magic number: " + std::to_string(magic));
+    return loadProgram(image + 4, size - 4, options);
+}
+
+} // namespace cvm
@@ -0,0 +1,35 @@
+#ifndef LIBCVM_H
+#define LIBCVM_H
+
+// C++ embedding API for the DEFCAA VM. Link with libcvm.a and
+// ../Covicc/libcovicc.a.
+//
+//     cvm::ProgramRef program = cvm::loadFile("script.cb");  // once
+//     cvm::Context context(program);                        // per instance
+//     context.output().captureTo(&text);
+//     context.run();
+//     context.reset();                                      // run it again
+//
+// A ProgramRef is immutable and may be shared by any number of contexts on
+// any number of threads. A Context must only be used by one thread at a
+// time; destroying it flushes its pending output.
+
+#include <cstdint>
+#include <string>
+#include "vm.h"
+
+namespace cvm {
+
+typedef ::ProgramRef ProgramRef;
+typedef ::RunOptions Options;
+typedef ::VirtualMachine Context;
+
+// Loads a .cb/.bc image, ASCII hex file or .covi source.
+ProgramRef loadFile(const std::string& filename, const Options& options = Options());
+
+// Loads an in-memory DEFCAA image, magic number included.
+ProgramRef loadImage(const uint8_t* image, size_t size, const Options& options = Options());
+
+} // namespace cvm
+
+#endif // LIBCVM_H
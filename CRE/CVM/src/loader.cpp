@@ -0,0 +1,101 @@
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hexdecode.h"
+#include "loader.h"
+
+namespace {
+
+// Closes a descriptor on every exit path of the constructor.
+class FileCloser {
+public:
+    explicit FileCloser(int fd) : fd(fd) {}
+    ~FileCloser() { close(fd); }
+
+private:
+    int fd;
+};
+
+} // namespace
+
+BytecodeImage::BytecodeImage(const std::string& filename)
+    : bytes(NULL), length(0), mapping(NULL) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Unable to open file " + filename + ": " + std::strerror(errno));
+    FileCloser closer(fd);
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* p = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // The decoder walks the image front to back, with forward jumps only.
+            madvise(p, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+            mapping = p;
+            bytes = static_cast<const uint8_t*>(p);
+            length = static_cast<size_t>(info.st_size);
+            return;
+        }
+    }
+    readAll(fd, filename);
+}
+
+BytecodeImage::BytecodeImage(std::vector<uint8_t>&& contents)
+    : bytes(NULL), length(0), mapping(NULL), buffer(std::move(contents)) {
+    bytes = buffer.data();
+    length = buffer.size();
+}
+
+BytecodeImage::~BytecodeImage() {
+    unmap();
+}
+
+void BytecodeImage::readAll(int fd, const std::string& filename) {
+    buffer.resize(64 * 1024);
+    size_t used = 0;
+    for (;;) {
+        if (used == buffer.size())
+            buffer.resize(buffer.size() * 2);
+        ssize_t n = read(fd, buffer.data() + used, buffer.size() - used);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Unable to read file " + filename + ": " + std::strerror(errno));
+        }
+        if (n == 0)
+            break;
+        used += static_cast<size_t>(n);
+    }
+    buffer.resize(used);
+    bytes = buffer.data();
+    length = used;
+}
+
+void BytecodeImage::unmap() {
+    if (mapping != NULL) {
+        munmap(mapping, length);
+        mapping = NULL;
+    }
+}
+
+bool BytecodeImage::decodeAsciiHex() {
+    // Decoded bytes go straight into the buffer Program::decode reads. It is
+    // left uninitialized: binary files bail out on their first byte, so an
+    // untouched allocation costs next to nothing.
+    std::unique_ptr<uint8_t[]> decoded(new uint8_t[length / 2 + 1]);
+    size_t written = 0;
+    if (::decodeAsciiHex(bytes, length, decoded.get(), &written) == HEX_NOT_HEX)
+        return false;
+
+    unmap();
+    std::vector<uint8_t>().swap(buffer);
+    hexBytes.swap(decoded);
+    bytes = hexBytes.get();
+    length = written;
+    return true;
+}
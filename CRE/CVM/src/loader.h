@@ -0,0 +1,43 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The bytes of a bytecode file. Regular files are mapped read-only and used
+// in place; pipes, character devices and anything mmap refuses are read into
+// a buffer instead. Either way data() stays valid for the image's lifetime.
+class BytecodeImage {
+public:
+    explicit BytecodeImage(const std::string& filename);
+    // Takes over bytes produced in memory, e.g. by the .covi compiler.
+    explicit BytecodeImage(std::vector<uint8_t>&& contents);
+    ~BytecodeImage();
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool mapped() const { return mapping != NULL; }
+
+    // If the file is ASCII hex (see hexdecode.h), replaces the contents with
+    // the bytes it spells out and returns true. Binary files are left as they
+    // are.
+    bool decodeAsciiHex();
+
+private:
+    BytecodeImage(const BytecodeImage&);
+    BytecodeImage& operator=(const BytecodeImage&);
+
+    void readAll(int fd, const std::string& filename);
+    void unmap();
+
+    const uint8_t* bytes;
+    size_t length;
+    void* mapping;              // Non-NULL while the file is mapped.
+    std::vector<uint8_t> buffer; // Backing store when read, not mapped.
+    std::unique_ptr<uint8_t[]> hexBytes; // Backing store after decodeAsciiHex().
+};
+
+#endif // LOADER_H
@@ -1,21 +1,142 @@
 #include <iostream>
 #include <fstream>
+#include <string>
 #include <vector>
+#include <cstdlib>
+#include "aot.h"
+#include "batch.h"
 #include "vm.h"
 
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--engine=switch|threaded|register] [--differential]\n"
+              << "       [--stack-size=N] [--cell-width=8|64] [--unbuffered]\n"
+              << "       [--no-fuse] [--verify|--no-verify] [--stats]\n"
+              << "       [--profile[=table|json|both]] [--jit]\n"
+              << "       [--no-cache] [--cache-dir=DIR] <bytecode_file|source.covi>\n"
+              << "       " << prog << " [options] --aot <bytecode_file|source.covi> -o <program|source.c>\n"
+              << "       " << prog << " [options] -j N [--tag] [--manifest=FILE] [files...]" << std::endl;
+}
+
+// Parses the N of -j N, -jN or --jobs=N; 0 if it is not a positive number.
+static size_t parseJobs(const char* text) {
+    long jobs = std::atol(text);
+    return jobs > 0 ? static_cast<size_t>(jobs) : 0;
+}
+
 int main(int argc, char* argv[]) {
+    RunOptions options;
+    BatchOptions batch;
+    bool batchMode = false;
+    bool aot = false;
+    std::string aotOutput;
+    std::vector<std::string> files;
+
     // Kiểm tra số lượng đối số
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <bytecode_file>" << std::endl;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--engine=switch") {
+            options.engine = ENGINE_SWITCH;
+        } else if (arg == "--engine=threaded") {
+            options.engine = ENGINE_THREADED;
+        } else if (arg == "--engine=register") {
+            options.engine = ENGINE_REGISTER;
+        } else if (arg == "--differential") {
+            options.differential = true;
+        } else if (arg.compare(0, 13, "--stack-size=") == 0) {
+            long size = std::atol(arg.c_str() + 13);
+            if (size <= 0) {
+                std::cerr << "Invalid stack size: " << arg << std::endl;
+                return 1;
+            }
+            options.stackSize = static_cast<size_t>(size);
+        } else if (arg == "--cell-width=8") {
+            options.wideCells = false;
+        } else if (arg == "--cell-width=64") {
+            options.wideCells = true;
+        } else if (arg == "--unbuffered") {
+            options.unbuffered = true;
+        } else if (arg == "--no-fuse") {
+            options.fuse = false;
+        } else if (arg == "--verify") {
+            options.strictVerify = true;
+        } else if (arg == "--no-verify") {
+            options.verify = false;
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg == "--profile" || arg == "--profile=table") {
+            options.profile = PROFILE_TABLE;
+        } else if (arg == "--profile=json") {
+            options.profile = PROFILE_JSON;
+        } else if (arg == "--profile=both") {
+            options.profile = PROFILE_BOTH;
+        } else if (arg == "--jit") {
+            options.jit = JIT_FORCE;
+        } else if (arg == "--aot") {
+            aot = true;
+        } else if (arg == "-o") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing file name after -o" << std::endl;
+                return 1;
+            }
+            aotOutput = argv[++i];
+        } else if (arg == "--no-cache") {
+            options.compileCache = false;
+        } else if (arg.compare(0, 12, "--cache-dir=") == 0) {
+            options.cacheDir = arg.substr(12);
+        } else if (arg == "-j" || arg.compare(0, 2, "-j") == 0 || arg.compare(0, 7, "--jobs=") == 0) {
+            const char* value = arg == "-j" ? (i + 1 < argc ? argv[++i] : "")
+                              : arg[1] == 'j' ? arg.c_str() + 2 : arg.c_str() + 7;
+            batch.workers = parseJobs(value);
+            if (batch.workers == 0) {
+                std::cerr << "Invalid job count: " << value << std::endl;
+                return 1;
+            }
+            batchMode = true;
+        } else if (arg == "--tag") {
+            batch.tagged = true;
+        } else if (arg.compare(0, 11, "--manifest=") == 0) {
+            try {
+                std::vector<std::string> listed = readManifest(arg.substr(11));
+                files.insert(files.end(), listed.begin(), listed.end());
+            } catch (const std::exception &e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+            batchMode = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            usage(argv[0]);
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty() && !batchMode) {
+        usage(argv[0]);
         return 1;
     }
+    if (aot) {
+        if (batchMode || files.size() != 1 || aotOutput.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+        try {
+            buildExecutable(files[0], aotOutput, options);
+        } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (batchMode || files.size() > 1)
+        return runBatch(files, options, batch);
     
     try {
-        runVM(argv[1]);
+        runVM(files[0], options);
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,103 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "output.h"
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+    : capacity(capacity > 0 ? capacity : 1), used(0), fd(fd), capture(NULL),
+      unbuffered(false), lineBuffered(isatty(fd) != 0) {}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::captureTo(std::string* capture) {
+    flush();
+    this->capture = capture;
+    lineBuffered = false;
+}
+
+void OutputBuffer::setUnbuffered(bool unbuffered) {
+    flush();
+    this->unbuffered = unbuffered;
+}
+
+// Called by put() when the buffer is full, or was never allocated: contexts
+// that print nothing never pay for the buffer.
+void OutputBuffer::makeRoom() {
+    if (buffer.empty())
+        buffer.resize(capacity);
+    else
+        flush();
+}
+
+void OutputBuffer::write(const char* data, size_t size) {
+    if (size == 0)
+        return;
+    if (size > buffer.size() - used) {
+        flush();
+        // Too big to be worth copying: hand it to the sink directly.
+        if (size >= capacity) {
+            if (capture) {
+                capture->append(data, size);
+                return;
+            }
+            while (size > 0) {
+                ssize_t n = ::write(fd, data, size);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return;
+                data += n;
+                size -= static_cast<size_t>(n);
+            }
+            return;
+        }
+        if (buffer.empty())
+            buffer.resize(capacity);
+    }
+    std::memcpy(&buffer[used], data, size);
+    used += size;
+    if (unbuffered)
+        flush();
+}
+
+// Formats a number right to left in a small local array, so PRINT_VAR never
+// allocates.
+void OutputBuffer::writeUnsigned(uint64_t value) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    write(p, static_cast<size_t>(digits + sizeof(digits) - p));
+}
+
+void OutputBuffer::newline() {
+    put('\n');
+    if (lineBuffered)
+        flush();
+}
+
+void OutputBuffer::flush() {
+    if (used == 0)
+        return;
+    if (capture) {
+        capture->append(&buffer[0], used);
+        used = 0;
+        return;
+    }
+    const char* data = &buffer[0];
+    size_t left = used;
+    while (left > 0) {
+        ssize_t n = ::write(fd, data, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // Like std::cout, a failed sink silently drops output.
+        data += n;
+        left -= static_cast<size_t>(n);
+    }
+    used = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Output buffer owned by a VirtualMachine. PRINT-family opcodes append here
+// instead of going through std::cout; bytes reach the sink when the buffer
+// fills, at a newline if the sink is a terminal, on flush(), and when the
+// buffer is destroyed. In unbuffered mode every write goes straight out.
+class OutputBuffer {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    // Writes to a file descriptor (stdout by default).
+    explicit OutputBuffer(int fd = 1, size_t capacity = DEFAULT_CAPACITY);
+    ~OutputBuffer();
+
+    // Sends output to `capture` instead of a file descriptor.
+    void captureTo(std::string* capture);
+    void setUnbuffered(bool unbuffered);
+
+    void put(char c) {
+        if (used == buffer.size())
+            makeRoom();
+        buffer[used++] = c;
+        if (unbuffered)
+            flush();
+    }
+    void write(const char* data, size_t size);
+    void writeUnsigned(uint64_t value);
+    void newline();
+    void flush();
+
+private:
+    OutputBuffer(const OutputBuffer&);
+    OutputBuffer& operator=(const OutputBuffer&);
+    void makeRoom();
+
+    std::vector<char> buffer; // Allocated on first use.
+    size_t capacity;
+    size_t used;
+    int fd;
+    std::string* capture;
+    bool unbuffered;
+    bool lineBuffered; // Sink is a terminal: flush at every newline.
+};
+
+#endif // OUTPUT_H
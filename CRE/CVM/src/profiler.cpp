@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "profiler.h"
+#include "program.h"
+#include "vm.h"
+
+namespace {
+
+double percent(uint64_t part, uint64_t whole) {
+    return whole == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(whole);
+}
+
+bool hotter(const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+} // namespace
+
+Profiler::Profiler(const Program& program)
+    : program(program), last(0), currentOp(IDLE),
+      pcCount(program.instructions().size() + 1, 0), pcTime(program.instructions().size() + 1, 0) {
+    currentPc = pcCount.size() - 1;
+    std::memset(opCount, 0, sizeof(opCount));
+    std::memset(opTime, 0, sizeof(opTime));
+    std::memset(branchTaken, 0, sizeof(branchTaken));
+    std::memset(branchNotTaken, 0, sizeof(branchNotTaken));
+}
+
+void Profiler::begin() {
+    currentOp = IDLE;
+    currentPc = pcCount.size() - 1;
+    last = clock();
+}
+
+uint64_t Profiler::dispatches() const {
+    uint64_t total = 0;
+    for (size_t op = 0; op < IDLE; ++op)
+        total += opCount[op];
+    return total;
+}
+
+void Profiler::finish() {
+    uint64_t now = clock();
+    opTime[currentOp] += now - last;
+    pcTime[currentPc] += now - last;
+    last = now;
+    currentOp = IDLE;
+    currentPc = pcCount.size() - 1;
+}
+
+const char* Profiler::unit() {
+#if defined(__x86_64__) || defined(__i386__)
+    return "cycles";
+#else
+    return "ns";
+#endif
+}
+
+void Profiler::report(std::ostream& out, ProfileFormat format) const {
+    if (format == PROFILE_TABLE || format == PROFILE_BOTH)
+        reportTable(out);
+    if (format == PROFILE_JSON || format == PROFILE_BOTH)
+        reportJson(out);
+}
+
+void Profiler::reportTable(std::ostream& out) const {
+    uint64_t totalCount = 0, totalTime = 0;
+    std::vector<std::pair<uint64_t, size_t> > ops;
+    for (size_t op = 0; op < IDLE; ++op) {
+        totalCount += opCount[op];
+        totalTime += opTime[op];
+        if (opCount[op] != 0)
+            ops.push_back(std::make_pair(opTime[op], op));
+    }
+    std::sort(ops.begin(), ops.end(), hotter);
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "[profile] %-26s %12s %14s %10s %7s\n",
+                  "opcode", "count", unit(), "per op", "time");
+    out << line;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        size_t op = ops[i].second;
+        std::snprintf(line, sizeof(line), "[profile] %-26s %12llu %14llu %10.1f %6.1f%%\n",
+                      opcodeName(static_cast<uint8_t>(op)), static_cast<unsigned long long>(opCount[op]),
+                      static_cast<unsigned long long>(opTime[op]),
+                      static_cast<double>(opTime[op]) / static_cast<double>(opCount[op]),
+                      percent(opTime[op], totalTime));
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "[profile] %-26s %12llu %14llu\n", "total",
+                  static_cast<unsigned long long>(totalCount), static_cast<unsigned long long>(totalTime));
+    out << line;
+
+    for (size_t op = 0; op < IDLE; ++op) {
+        uint64_t taken = branchTaken[op], notTaken = branchNotTaken[op];
+        if (taken + notTaken == 0)
+            continue;
+        std::snprintf(line, sizeof(line), "[profile] branch %s: %llu taken, %llu not taken (%.1f%% taken)\n",
+                      opcodeName(static_cast<uint8_t>(op)), static_cast<unsigned long long>(taken),
+                      static_cast<unsigned long long>(notTaken), percent(taken, taken + notTaken));
+        out << line;
+    }
+
+    // The ten instructions that ran most often.
+    std::vector<std::pair<uint64_t, size_t> > pcs;
+    for (size_t pc = 0; pc + 1 < pcCount.size(); ++pc) {
+        if (pcCount[pc] != 0)
+            pcs.push_back(std::make_pair(pcCount[pc], pc));
+    }
+    std::sort(pcs.begin(), pcs.end(), hotter);
+    if (pcs.size() > 10)
+        pcs.resize(10);
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        size_t pc = pcs[i].second;
+        std::snprintf(line, sizeof(line), "[profile] hot pc %zu (byte %u) %-26s %12llu runs %14llu %s\n",
+                      pc, program.byteOffset(pc), opcodeName(program.instructions()[pc].op),
+                      static_cast<unsigned long long>(pcCount[pc]),
+                      static_cast<unsigned long long>(pcTime[pc]), unit());
+        out << line;
+    }
+}
+
+void Profiler::reportJson(std::ostream& out) const {
+    out << "{\"unit\": \"" << unit() << "\", \"opcodes\": [";
+    const char* separator = "";
+    for (size_t op = 0; op < IDLE; ++op) {
+        if (opCount[op] == 0)
+            continue;
+        out << separator << "{\"name\": \"" << opcodeName(static_cast<uint8_t>(op)) << "\", \"opcode\": " << op
+            << ", \"count\": " << opCount[op] << ", \"time\": " << opTime[op] << "}";
+        separator = ", ";
+    }
+    out << "], \"branches\": [";
+    separator = "";
+    for (size_t op = 0; op < IDLE; ++op) {
+        if (branchTaken[op] + branchNotTaken[op] == 0)
+            continue;
+        out << separator << "{\"name\": \"" << opcodeName(static_cast<uint8_t>(op)) << "\", \"taken\": "
+            << branchTaken[op] << ", \"not_taken\": " << branchNotTaken[op] << "}";
+        separator = ", ";
+    }
+    out << "], \"pcs\": [";
+    separator = "";
+    for (size_t pc = 0; pc + 1 < pcCount.size(); ++pc) {
+        if (pcCount[pc] == 0)
+            continue;
+        out << separator << "{\"pc\": " << pc << ", \"byte\": " << program.byteOffset(pc) << ", \"op\": \""
+            << opcodeName(program.instructions()[pc].op) << "\", \"count\": " << pcCount[pc]
+            << ", \"time\": " << pcTime[pc] << "}";
+        separator = ", ";
+    }
+    out << "]}" << std::endl;
+}
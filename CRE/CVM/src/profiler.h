@@ -0,0 +1,93 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+class Program;
+
+// What --profile prints when the run ends.
+enum ProfileFormat {
+    PROFILE_OFF,
+    PROFILE_TABLE,
+    PROFILE_JSON,
+    PROFILE_BOTH
+};
+
+// Per-opcode and per-instruction execution profile. Engines instantiated
+// with Profiled = true call step() as they dispatch each instruction, and
+// branch() from conditional jumps; the unprofiled instantiations contain no
+// calls at all, so profiling costs nothing when it is off.
+//
+// Time is measured between consecutive dispatches, in TSC cycles on x86 and
+// in nanoseconds elsewhere, and charged to the instruction that ran.
+class Profiler {
+public:
+    explicit Profiler(const Program& program);
+
+    // Starts the clock; call right before the first dispatch.
+    void begin();
+
+    void step(size_t pc, uint8_t op) {
+        uint64_t now = clock();
+        uint64_t elapsed = now - last;
+        opTime[currentOp] += elapsed;
+        pcTime[currentPc] += elapsed;
+        last = now;
+        currentOp = op;
+        currentPc = pc;
+        ++opCount[op];
+        ++pcCount[pc];
+    }
+
+    void branch(uint8_t op, bool taken) {
+        ++(taken ? branchTaken : branchNotTaken)[op];
+    }
+
+    // Charges the time since the last dispatch; call when execution stops.
+    void finish();
+
+    void report(std::ostream& out, ProfileFormat format) const;
+
+    // Instructions dispatched so far; a superinstruction counts once.
+    uint64_t dispatches() const;
+
+    // "cycles" or "ns".
+    static const char* unit();
+
+private:
+    static uint64_t clock() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    void reportTable(std::ostream& out) const;
+    void reportJson(std::ostream& out) const;
+
+    // Index IDLE is a scratch slot for time before the first dispatch.
+    static const size_t IDLE = 256;
+
+    const Program& program;
+    uint64_t last;
+    size_t currentOp;
+    size_t currentPc;
+    uint64_t opCount[IDLE + 1];
+    uint64_t opTime[IDLE + 1];
+    uint64_t branchTaken[IDLE];
+    uint64_t branchNotTaken[IDLE];
+    std::vector<uint64_t> pcCount; // One slot per instruction, plus the scratch slot.
+    std::vector<uint64_t> pcTime;
+};
+
+#endif // PROFILER_H
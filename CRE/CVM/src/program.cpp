@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "program.h"
+#include "vm.h"
+
+namespace {
+
+// An instruction as found in the image, before jump targets become indices.
+struct RawInstruction {
+    uint32_t offset;
+    Instruction insn;
+    bool isJump;
+    uint32_t target; // Byte offset of the jump target.
+
+    bool operator<(const RawInstruction& other) const { return offset < other.offset; }
+};
+
+// Assigns dense slot numbers to variable names in order of first appearance.
+class SlotTable {
+public:
+    uint32_t resolve(const std::string& name) {
+        std::unordered_map<std::string, uint32_t>::const_iterator it = index.find(name);
+        if (it != index.end())
+            return it->second;
+        uint32_t slot = static_cast<uint32_t>(names.size());
+        index[name] = slot;
+        names.push_back(name);
+        return slot;
+    }
+
+    std::vector<std::string> names;
+
+private:
+    std::unordered_map<std::string, uint32_t> index;
+};
+
+std::string byteLabel(size_t offset) {
+    return " at byte " + std::to_string(offset);
+}
+
+// Returns the number of operand bytes for a fixed-size opcode, or -1 if the
+// opcode is unknown. Length-prefixed opcodes report their prefix only.
+int operandSize(uint8_t opcode) {
+    switch (opcode) {
+        case ADD: case PRINT: case PRINTLN: case PRINT_NO_NL: case NOP:
+        case OP_TO_STRING: case OP_CONCAT: case OP_COMPARE:
+            return 0;
+        case PUSH: case LOAD_VAR: case PRINT_VAR:
+        case OP_INPUT: case OP_LOAD_STRING:
+            return 1;
+        case PUSH_VAR: case JUMP_IF_ZERO: case JUMP:
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+} // namespace
+
+uint64_t ProgramGeneration::next() {
+    static std::atomic<uint64_t> counter(0);
+    return ++counter;
+}
+
+// Decodes every instruction reachable from the entry point or from a jump
+// target. Bytes that are only ever jumped over are left undecoded, so images
+// may embed data after an unconditional JUMP just as the streaming reader
+// allowed.
+Program Program::decode(const uint8_t* code, size_t size) {
+    if (size > UINT32_MAX)
+        throw std::runtime_error("Bytecode image too large");
+
+    std::vector<RawInstruction> raw;
+    std::vector<int8_t> coverage(size, 0); // 0 = unseen, 1 = opcode byte, 2 = operand byte
+    std::vector<uint32_t> worklist(1, 0);
+    std::string pool;
+    std::unordered_map<std::string, uint32_t> interned; // Literal -> its offset in pool.
+    SlotTable slots;
+
+    while (!worklist.empty()) {
+        size_t pos = worklist.back();
+        worklist.pop_back();
+
+        while (pos < size && coverage[pos] != 1) {
+            if (coverage[pos] == 2)
+                throw std::runtime_error("Jump target is not on an instruction boundary" + byteLabel(pos));
+
+            RawInstruction r = RawInstruction();
+            r.offset = static_cast<uint32_t>(pos);
+            r.insn.op = code[pos];
+            size_t length = 1;
+
+            int operands = operandSize(code[pos]);
+            if (operands < 0) {
+                // Unknown opcodes only fail if execution actually reaches them.
+                r.insn.imm = code[pos];
+                r.insn.op = OP_TRAP;
+            } else {
+                if (pos + 1 + operands > size)
+                    throw std::runtime_error("Truncated operand for opcode " +
+                                             std::to_string(code[pos]) + byteLabel(pos));
+                const uint8_t* operand = code + pos + 1;
+                length += operands;
+                switch (code[pos]) {
+                    case PUSH:
+                        r.insn.imm = operand[0];
+                        break;
+                    case LOAD_VAR:
+                    case PRINT_VAR:
+                        // Single-byte ids name the same variable as a one-character OP_INPUT name.
+                        r.insn.arg = slots.resolve(std::string(1, static_cast<char>(operand[0])));
+                        break;
+                    case PUSH_VAR:
+                        r.insn.arg = slots.resolve(std::string(1, static_cast<char>(operand[0])));
+                        r.insn.imm = operand[1];
+                        break;
+                    case JUMP_IF_ZERO:
+                    case JUMP:
+                        // Offsets are unsigned and relative to the next instruction.
+                        r.isJump = true;
+                        r.target = static_cast<uint32_t>(
+                            std::min<size_t>(pos + 3 + ((operand[0] << 8) | operand[1]), size));
+                        break;
+                    case OP_INPUT:
+                    case OP_LOAD_STRING:
+                        if (pos + 2 + operand[0] > size)
+                            throw std::runtime_error("Truncated string operand for opcode " +
+                                                     std::to_string(code[pos]) + byteLabel(pos));
+                        length += operand[0];
+                        if (code[pos] == OP_INPUT) {
+                            r.insn.arg = slots.resolve(std::string(reinterpret_cast<const char*>(operand + 1), operand[0]));
+                            break;
+                        }
+                        r.insn.len = operand[0];
+                        {
+                            // Identical literals share one copy in the pool.
+                            std::string literal(reinterpret_cast<const char*>(operand + 1), operand[0]);
+                            std::unordered_map<std::string, uint32_t>::iterator it = interned.find(literal);
+                            if (it == interned.end()) {
+                                it = interned.insert(std::make_pair(literal, static_cast<uint32_t>(pool.size()))).first;
+                                pool.append(literal);
+                            }
+                            r.insn.arg = it->second;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            for (size_t i = 0; i < length; ++i) {
+                if (coverage[pos + i] != 0)
+                    throw std::runtime_error("Jump target is not on an instruction boundary" +
+                                             byteLabel(i == 0 ? pos : pos + i));
+                coverage[pos + i] = i == 0 ? 1 : 2;
+            }
+            raw.push_back(r);
+
+            if (r.isJump && r.target < size)
+                worklist.push_back(r.target);
+            if (r.insn.op == JUMP || r.insn.op == OP_TRAP)
+                break;
+            pos += length;
+        }
+    }
+
+    std::sort(raw.begin(), raw.end());
+
+    // Byte offset -> instruction index; everything at or past the end halts.
+    std::vector<uint32_t> indexOf(size + 1, 0);
+    for (size_t i = 0; i < raw.size(); ++i)
+        indexOf[raw[i].offset] = static_cast<uint32_t>(i);
+    indexOf[size] = static_cast<uint32_t>(raw.size());
+
+    Program program;
+    program.code.reserve(raw.size() + 1);
+    program.offsets.reserve(raw.size() + 1);
+    for (size_t i = 0; i < raw.size(); ++i) {
+        Instruction insn = raw[i].insn;
+        if (raw[i].isJump)
+            insn.arg = indexOf[raw[i].target];
+        program.code.push_back(insn);
+        program.offsets.push_back(raw[i].offset);
+    }
+    Instruction halt = Instruction();
+    halt.op = OP_HALT;
+    program.code.push_back(halt);
+    program.offsets.push_back(static_cast<uint32_t>(size));
+    program.pool.swap(pool);
+    program.slotNames.swap(slots.names);
+    return program;
+}
+
+namespace {
+
+bool isJumpOp(uint8_t op) {
+    return op == JUMP || op == JUMP_IF_ZERO || op == OP_COMPARE_VAR_IMM_BRANCH;
+}
+
+} // namespace
+
+void Program::fuse() {
+    FusionCounter literalRuns = { "PRINT_LITERAL_RUN", 0, 0 };
+    FusionCounter compareBranches = { "COMPARE_VAR_IMM_BRANCH", 0, 0 };
+
+    std::vector<bool> isTarget(code.size(), false);
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (isJumpOp(code[i].op))
+            isTarget[code[i].arg] = true;
+    }
+
+    std::vector<Instruction> fused;
+    std::vector<uint32_t> fusedOffsets;
+    std::vector<uint32_t> newIndex(code.size(), 0);
+    fused.reserve(code.size());
+    fusedOffsets.reserve(code.size());
+
+    for (size_t i = 0; i < code.size();) {
+        newIndex[i] = static_cast<uint32_t>(fused.size());
+        Instruction insn = code[i];
+        size_t consumed = 1;
+
+        // PUSH c; PRINT pairs, as covicc emits for every string character.
+        size_t pairs = 0;
+        while (i + 2 * pairs + 1 < code.size() && pairs < UINT16_MAX &&
+               code[i + 2 * pairs].op == PUSH && code[i + 2 * pairs + 1].op == PRINT &&
+               !isTarget[i + 2 * pairs + 1] && (pairs == 0 || !isTarget[i + 2 * pairs]))
+            ++pairs;
+
+        if (pairs >= 2) {
+            insn = Instruction();
+            insn.op = OP_PRINT_LITERAL_RUN;
+            insn.len = static_cast<uint16_t>(pairs);
+            insn.arg = static_cast<uint32_t>(pool.size());
+            for (size_t p = 0; p < pairs; ++p)
+                pool.push_back(static_cast<char>(code[i + 2 * p].imm));
+            consumed = 2 * pairs;
+            ++literalRuns.sites;
+            literalRuns.folded += consumed;
+        } else if (i + 3 < code.size() && code[i].op == LOAD_VAR && code[i].arg <= UINT16_MAX &&
+                   code[i + 1].op == PUSH && code[i + 2].op == OP_COMPARE &&
+                   code[i + 3].op == JUMP_IF_ZERO &&
+                   !isTarget[i + 1] && !isTarget[i + 2] && !isTarget[i + 3]) {
+            // LOAD_VAR; PUSH k; OP_COMPARE; JUMP_IF_ZERO, the shape of a covicc `if`.
+            insn = Instruction();
+            insn.op = OP_COMPARE_VAR_IMM_BRANCH;
+            insn.len = static_cast<uint16_t>(code[i].arg);
+            insn.imm = code[i + 1].imm;
+            insn.arg = code[i + 3].arg;
+            consumed = 4;
+            ++compareBranches.sites;
+            compareBranches.folded += consumed;
+        }
+
+        fused.push_back(insn);
+        fusedOffsets.push_back(offsets[i]);
+        i += consumed;
+    }
+
+    // Only the first instruction of a fused sequence can be a jump target, so
+    // every target has an entry in newIndex.
+    for (size_t i = 0; i < fused.size(); ++i) {
+        if (isJumpOp(fused[i].op))
+            fused[i].arg = newIndex[fused[i].arg];
+    }
+
+    code.swap(fused);
+    offsets.swap(fusedOffsets);
+    verifyResult = Verification();
+    registers = RegisterCode();
+    fusions.clear();
+    fusions.push_back(literalRuns);
+    fusions.push_back(compareBranches);
+}
@@ -0,0 +1,117 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "regir.h"
+
+// Internal opcodes that never appear in a DEFCAA image. They live in byte
+// values unused by the on-disk Opcode set so both share one dispatch space.
+enum InternalOpcode {
+    OP_HALT = 0xF0, // End of the instruction stream (or a jump past it).
+    OP_TRAP = 0xF1, // Unsupported opcode; raises the error when reached.
+
+    // Superinstructions produced by Program::fuse().
+    OP_PRINT_LITERAL_RUN = 0xF2,      // (PUSH c; PRINT) x len, chars at pool offset arg.
+    OP_COMPARE_VAR_IMM_BRANCH = 0xF3  // LOAD_VAR len; PUSH imm; OP_COMPARE; JUMP_IF_ZERO arg.
+};
+
+// One decoded instruction. Operands are unpacked at load time so the
+// interpreter never touches the raw image while running.
+struct Instruction {
+    uint8_t op;    // Opcode or InternalOpcode.
+    uint8_t imm;   // PUSH value, PUSH_VAR immediate, or the raw byte for OP_TRAP.
+    uint16_t len;  // String/run length, or the variable slot of a fused compare.
+    uint32_t arg;  // Variable slot, jump target index, or string pool offset.
+};
+
+// Load-time counters for one kind of superinstruction.
+struct FusionCounter {
+    const char* name;
+    size_t sites;  // Superinstructions produced.
+    size_t folded; // Original instructions they replaced.
+};
+
+// Outcome of Program::verify().
+struct Verification {
+    Verification() : verified(false), maxStackDepth(0), pc(0) {}
+    bool verified;        // Every path is free of underflow and undefined reads.
+    size_t maxStackDepth; // Deepest operand stack on any path.
+    size_t pc;            // Instruction index of the first failure.
+    std::string reason;   // Diagnostic naming the pc and byte offset.
+    std::vector<uint32_t> depths; // Stack depth on entry to each instruction; UNREACHED if none.
+    static const uint32_t UNREACHED = UINT32_MAX;
+};
+
+// A number no other Program in the process has had. Copies get a new one,
+// so state derived from one Program object, such as JIT code that points
+// into its instructions, is never mistaken for another's, even one later
+// allocated at the same address.
+class ProgramGeneration {
+public:
+    ProgramGeneration() : value(next()) {}
+    ProgramGeneration(const ProgramGeneration&) : value(next()) {}
+    ProgramGeneration& operator=(const ProgramGeneration&) {
+        value = next();
+        return *this;
+    }
+    uint64_t get() const { return value; }
+
+private:
+    static uint64_t next();
+    uint64_t value;
+};
+
+// A DEFCAA image decoded into a flat array of fixed-width instructions.
+// Jump targets are instruction indices; the last instruction is OP_HALT.
+// Variable names are resolved to dense slot indices, so the interpreter can
+// keep variables in a flat array and only needs the names for diagnostics.
+class Program {
+public:
+    // Decodes the instruction bytes that follow the 4-byte magic number.
+    static Program decode(const uint8_t* code, size_t size);
+
+    // Peephole pass that rewrites common opcode sequences into internal
+    // superinstructions. Sequences are never fused across a jump target.
+    void fuse();
+    const std::vector<FusionCounter>& fusionCounters() const { return fusions; }
+
+    // Proves stack safety and variable definedness once at load time
+    // (verifier.cpp). Run it after fuse(); rewriting the code again
+    // invalidates the result.
+    void verify();
+    const Verification& verification() const { return verifyResult; }
+
+    // Translates a verified program into the register IR (regir.h) for the
+    // register engine. Does nothing if verification failed; like verify(),
+    // it must run again if the code is rewritten.
+    void lowerToRegisters();
+    const RegisterCode* registerCode() const { return registers.code.empty() ? NULL : &registers; }
+
+    const std::vector<Instruction>& instructions() const { return code; }
+    const char* string(const Instruction& insn) const { return pool.data() + insn.arg; }
+    const char* string(uint32_t offset) const { return pool.data() + offset; }
+
+    // Byte offset (relative to the end of the magic) an instruction came from.
+    uint32_t byteOffset(size_t index) const { return offsets[index]; }
+
+    size_t slotCount() const { return slotNames.size(); }
+    const std::string& slotName(size_t slot) const { return slotNames[slot]; }
+
+    // Never 0; see ProgramGeneration.
+    uint64_t generation() const { return generationId.get(); }
+
+private:
+    ProgramGeneration generationId;
+    std::vector<Instruction> code;
+    std::vector<uint32_t> offsets;
+    std::string pool; // Bytes of OP_LOAD_STRING literals.
+    std::vector<std::string> slotNames;
+    std::vector<FusionCounter> fusions;
+    Verification verifyResult;
+    RegisterCode registers;
+};
+
+#endif // PROGRAM_H
@@ -0,0 +1,249 @@
+#include <utility>
+#include <vector>
+#include "program.h"
+#include "vm.h"
+
+namespace {
+
+// A stack cell as known while translating a basic block: still in a
+// variable, a constant, or already in its own register.
+struct Operand {
+    bool immediate;
+    uint32_t value; // Register number or immediate.
+};
+
+class Lowering {
+public:
+    explicit Lowering(const Program& program)
+        : program(program), code(program.instructions()),
+          depths(program.verification().depths),
+          firstTemp(static_cast<uint32_t>(program.slotCount())),
+          labels(code.size(), 0), isTarget(code.size(), false) {}
+
+    RegisterCode run() {
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            if (code[pc].op == JUMP || code[pc].op == JUMP_IF_ZERO || code[pc].op == OP_COMPARE_VAR_IMM_BRANCH)
+                isTarget[code[pc].arg] = true;
+        }
+
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            if (depths[pc] == Verification::UNREACHED)
+                continue;
+            if (pc == 0 || isTarget[pc]) {
+                // Every path into a block leaves each cell in its register.
+                flush();
+                labels[pc] = static_cast<uint32_t>(out.code.size());
+                stack.clear();
+                for (uint32_t d = 0; d < depths[pc]; ++d)
+                    stack.push_back(reg(firstTemp + d));
+            }
+            pc = translate(pc);
+        }
+
+        for (size_t i = 0; i < out.code.size(); ++i) {
+            if (isBranch(out.code[i].op))
+                out.code[i].dst = labels[out.code[i].dst];
+        }
+        out.registerCount = firstTemp + program.verification().maxStackDepth;
+        return out;
+    }
+
+private:
+    static Operand reg(uint32_t r) { Operand o = { false, r }; return o; }
+    static Operand imm(uint32_t v) { Operand o = { true, v }; return o; }
+    static bool isBranch(uint32_t op) {
+        return op == R_JMP || op == R_JZ || op == R_JLE || op == R_JLEI || op == R_JGEI;
+    }
+
+    void emit(uint32_t op, uint32_t dst, uint32_t a, uint32_t b) {
+        RegisterInstruction insn = { op, dst, a, b };
+        out.code.push_back(insn);
+    }
+
+    void move(uint32_t dst, const Operand& from) {
+        if (from.immediate)
+            emit(R_MOVI, dst, 0, from.value);
+        else if (from.value != dst)
+            emit(R_MOV, dst, from.value, 0);
+    }
+
+    // Writes cell `depth` to its register. A cell is only ever an immediate,
+    // a variable, or its own register, so this never clobbers another cell.
+    void materialize(size_t depth) {
+        uint32_t r = firstTemp + static_cast<uint32_t>(depth);
+        if (stack[depth].immediate || stack[depth].value != r) {
+            move(r, stack[depth]);
+            stack[depth] = reg(r);
+        }
+    }
+    void flush() {
+        for (size_t d = 0; d < stack.size(); ++d)
+            materialize(d);
+    }
+    // Cells still reading variable `slot` take its value before it changes.
+    void beforeWrite(uint32_t slot) {
+        for (size_t d = 0; d < stack.size(); ++d) {
+            if (!stack[d].immediate && stack[d].value == slot)
+                materialize(d);
+        }
+    }
+
+    Operand pop() {
+        Operand o = stack.back();
+        stack.pop_back();
+        return o;
+    }
+    uint32_t top() const { return firstTemp + static_cast<uint32_t>(stack.size()); }
+
+    // Translates the instruction at `pc`; returns the last pc it consumed.
+    size_t translate(size_t pc) {
+        const Instruction& insn = code[pc];
+        switch (insn.op) {
+            case PUSH:
+                stack.push_back(imm(insn.imm));
+                break;
+            case LOAD_VAR:
+                stack.push_back(reg(insn.arg));
+                break;
+            case ADD: {
+                Operand b = pop(), a = pop();
+                if (a.immediate)
+                    std::swap(a, b);
+                uint32_t dst = top();
+                if (a.immediate) {
+                    emit(R_MOVI, dst, 0, a.value);
+                    a = reg(dst);
+                }
+                emit(b.immediate ? R_ADDI : R_ADD, dst, a.value, b.value);
+                stack.push_back(reg(dst));
+                break;
+            }
+            case OP_COMPARE: {
+                Operand b = pop(), a = pop();
+                // COMPARE; JUMP_IF_ZERO is a single branch on !(a > b).
+                if (pc + 1 < code.size() && code[pc + 1].op == JUMP_IF_ZERO && !isTarget[pc + 1]) {
+                    flush();
+                    uint32_t target = code[pc + 1].arg;
+                    if (a.immediate && b.immediate) {
+                        if (!(a.value > b.value))
+                            emit(R_JMP, target, 0, 0);
+                    } else if (b.immediate) {
+                        emit(R_JLEI, target, a.value, b.value);
+                    } else if (a.immediate) {
+                        emit(R_JGEI, target, b.value, a.value);
+                    } else {
+                        emit(R_JLE, target, a.value, b.value);
+                    }
+                    return pc + 1;
+                }
+                uint32_t dst = top();
+                if (a.immediate && b.immediate) {
+                    stack.push_back(imm(a.value > b.value ? 1 : 0));
+                    break;
+                }
+                if (b.immediate)
+                    emit(R_GTI, dst, a.value, b.value);
+                else if (a.immediate)
+                    emit(R_LTI, dst, b.value, a.value);
+                else
+                    emit(R_GT, dst, a.value, b.value);
+                stack.push_back(reg(dst));
+                break;
+            }
+            case JUMP_IF_ZERO: {
+                Operand cond = pop();
+                flush();
+                if (!cond.immediate)
+                    emit(R_JZ, insn.arg, cond.value, 0);
+                else if (cond.value == 0)
+                    emit(R_JMP, insn.arg, 0, 0);
+                break;
+            }
+            case JUMP:
+                flush();
+                emit(R_JMP, insn.arg, 0, 0);
+                break;
+            case OP_COMPARE_VAR_IMM_BRANCH:
+                flush();
+                emit(R_JLEI, insn.arg, insn.len, insn.imm);
+                break;
+            case PUSH_VAR:
+                beforeWrite(insn.arg);
+                emit(R_MOVI, insn.arg, 0, insn.imm);
+                break;
+            case OP_INPUT:
+                beforeWrite(insn.arg);
+                emit(R_INPUT, insn.arg, 0, 0);
+                break;
+            case PRINT:
+            case PRINT_NO_NL:
+                // The verifier knows whether a string is pending: if so the
+                // depth is unchanged and the stack is left alone.
+                if (depths[pc + 1] == depths[pc]) {
+                    emit(R_PRINT_STRINGS, 0, 0, 0);
+                } else {
+                    Operand c = pop();
+                    emit(c.immediate ? R_PUTI : R_PUT, 0, c.value, c.immediate ? c.value : 0);
+                }
+                break;
+            case PRINTLN:
+                flush();
+                emit(R_PRINTLN, 0, firstTemp, static_cast<uint32_t>(stack.size()));
+                stack.clear();
+                break;
+            case PRINT_VAR:
+                emit(R_PRINT_VAR, 0, insn.arg, 0);
+                break;
+            case OP_LOAD_STRING:
+                emit(R_LOAD_STRING, 0, insn.arg, insn.len);
+                break;
+            case OP_TO_STRING: {
+                Operand value = pop();
+                emit(value.immediate ? R_TO_STRINGI : R_TO_STRING, 0, value.value, value.value);
+                break;
+            }
+            case OP_CONCAT:
+                emit(R_CONCAT, 0, 0, 0);
+                break;
+            case OP_PRINT_LITERAL_RUN:
+                if (depths[pc + 1] > depths[pc]) {
+                    // A pending string: the first pair prints it and leaves
+                    // its character pushed, the rest print normally.
+                    emit(R_PRINT_STRINGS, 0, 0, 0);
+                    stack.push_back(imm(static_cast<uint8_t>(program.string(insn)[0])));
+                    if (insn.len > 1)
+                        emit(R_WRITE, 0, insn.arg + 1, insn.len - 1u);
+                } else {
+                    emit(R_WRITE, 0, insn.arg, insn.len);
+                }
+                break;
+            case OP_HALT:
+                flush();
+                emit(R_HALT, 0, firstTemp, static_cast<uint32_t>(stack.size()));
+                break;
+            case NOP:
+            default: // OP_TRAP is never reachable in a verified program.
+                break;
+        }
+        return pc;
+    }
+
+    const Program& program;
+    const std::vector<Instruction>& code;
+    const std::vector<uint32_t>& depths;
+    uint32_t firstTemp;
+    std::vector<uint32_t> labels;  // Stack pc -> IR index of a block start.
+    std::vector<bool> isTarget;
+    std::vector<Operand> stack;
+    RegisterCode out;
+};
+
+} // namespace
+
+// One pass over the code in order. Blocks start at pc 0 and at jump targets;
+// unreachable instructions are dropped.
+void Program::lowerToRegisters() {
+    registers = RegisterCode();
+    if (verifyResult.verified)
+        registers = Lowering(*this).run();
+}
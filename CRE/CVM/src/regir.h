@@ -0,0 +1,58 @@
+#ifndef REGIR_H
+#define REGIR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Three-address register IR, built from a verified Program by
+// Program::lowerToRegisters() (regir.cpp) and run by the register engine.
+//
+// Registers 0..slotCount-1 are the variable slots. Register slotCount + d
+// holds the operand stack cell at depth d. The verifier gives every
+// instruction a single stack depth, so each cell has a fixed register.
+// Within a basic block, pushed constants and variables are used as operands
+// directly instead of being copied to the stack. COMPARE; JUMP_IF_ZERO
+// becomes one branch. Cells are written to their registers only where a
+// block ends or an instruction needs the stack as a whole (PRINTLN, HALT).
+enum RegisterOpcode {
+    R_MOV,           // r[dst] = r[a]
+    R_MOVI,          // r[dst] = b
+    R_ADD,           // r[dst] = (r[a] + r[b]) & mask
+    R_ADDI,          // r[dst] = (r[a] + b) & mask
+    R_GT,            // r[dst] = r[a] > r[b]
+    R_GTI,           // r[dst] = r[a] > b
+    R_LTI,           // r[dst] = r[a] < b   (an immediate compared with a register)
+    R_JMP,           // goto dst
+    R_JZ,            // if r[a] == 0 goto dst
+    R_JLE,           // if !(r[a] > r[b]) goto dst
+    R_JLEI,          // if !(r[a] > b) goto dst
+    R_JGEI,          // if !(b > r[a]) goto dst
+    R_PUT,           // output the low byte of r[a]
+    R_PUTI,          // output the byte b
+    R_PRINT_STRINGS, // output strBuffer, clear both string buffers
+    R_PRINTLN,       // output the low bytes of r[a] .. r[a+b-1], then a newline
+    R_PRINT_VAR,     // output r[a] in decimal
+    R_INPUT,         // r[dst] = the next input line as a number
+    R_LOAD_STRING,   // strBuffer = b bytes of the string pool at a
+    R_TO_STRING,     // strOperand = decimal r[a]
+    R_TO_STRINGI,    // strOperand = decimal b
+    R_CONCAT,        // strBuffer += strOperand
+    R_WRITE,         // output b bytes of the string pool at a
+    R_HALT           // leave r[a] .. r[a+b-1] on the operand stack and stop
+};
+
+struct RegisterInstruction {
+    uint32_t op;  // RegisterOpcode.
+    uint32_t dst; // Destination register or branch target.
+    uint32_t a;   // Register, or pool offset.
+    uint32_t b;   // Register, immediate, length or count.
+};
+
+struct RegisterCode {
+    RegisterCode() : registerCount(0) {}
+    std::vector<RegisterInstruction> code;
+    size_t registerCount; // Variable slots plus the deepest stack.
+};
+
+#endif // REGIR_H
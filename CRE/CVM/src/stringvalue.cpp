@@ -0,0 +1,29 @@
+#include "stringvalue.h"
+
+void StringValue::assignNumber(uint64_t value) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    headSize = 0;
+    tail.assign(p, static_cast<size_t>(digits + sizeof(digits) - p));
+}
+
+void StringValue::append(const StringValue& other) {
+    if (&other == this) {
+        StringValue copy(other);
+        append(copy);
+        return;
+    }
+    // A value with nothing in it can share the other's literal; otherwise
+    // the literal's bytes join the tail.
+    if (empty()) {
+        head = other.head;
+        headSize = other.headSize;
+    } else {
+        tail.append(other.head, other.headSize);
+    }
+    tail.append(other.tail);
+}
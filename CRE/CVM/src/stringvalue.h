@@ -0,0 +1,53 @@
+#ifndef STRINGVALUE_H
+#define STRINGVALUE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "output.h"
+
+// Value of a VM string register (strBuffer, strOperand): a two-piece rope.
+// The head is a literal that points into the Program's string pool and is
+// never copied. The tail is an owned buffer that only grows, so CONCAT
+// costs the length of what it appends, not of the whole string. Printing
+// writes both pieces straight into the OutputBuffer.
+//
+// LOAD_STRING sets a head, TO_STRING a tail, and CONCAT appends to the
+// tail, so that is every shape the opcodes build. clear() keeps the tail's
+// capacity, so a VM that builds and prints a line per iteration stops
+// allocating after the first.
+class StringValue {
+public:
+    StringValue() : head(NULL), headSize(0) {}
+
+    bool empty() const { return headSize == 0 && tail.empty(); }
+    size_t size() const { return headSize + tail.size(); }
+    void clear() {
+        headSize = 0;
+        tail.clear();
+    }
+
+    // Refers to `size` bytes that must outlive the value: a literal in the
+    // string pool of the Program being run.
+    void assignLiteral(const char* data, size_t size) {
+        head = data;
+        headSize = size;
+        tail.clear();
+    }
+    // The decimal digits of `value`.
+    void assignNumber(uint64_t value);
+    void append(const StringValue& other);
+
+    void writeTo(OutputBuffer& out) const {
+        out.write(head, headSize);
+        out.write(tail.data(), tail.size());
+    }
+    std::string str() const { return std::string(head, headSize) + tail; }
+
+private:
+    const char* head;
+    size_t headSize;
+    std::string tail;
+};
+
+#endif // STRINGVALUE_H
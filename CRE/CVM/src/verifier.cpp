@@ -0,0 +1,247 @@
+#include <sstream>
+#include <string>
+#include <vector>
+#include "program.h"
+#include "vm.h"
+
+const uint32_t Verification::UNREACHED;
+
+namespace {
+
+// What is known about strBuffer or strOperand at a program point. PRINT only
+// pops when strBuffer is empty, so the verifier has to track it.
+enum StringState {
+    STR_EMPTY,
+    STR_SET,
+    STR_UNKNOWN
+};
+
+// Abstract VM state on entry to an instruction.
+struct State {
+    size_t depth;
+    StringState buffer;
+    StringState operand;
+    std::vector<bool> defined; // Variable slots assigned on every path here.
+};
+
+class Verifier {
+public:
+    explicit Verifier(const Program& program)
+        : program(program), code(program.instructions()),
+          states(code.size()), visited(code.size(), false) {}
+
+    Verification run() {
+        Verification result;
+        State entry;
+        entry.depth = 0;
+        entry.buffer = STR_EMPTY;
+        entry.operand = STR_EMPTY;
+        entry.defined.assign(program.slotCount(), false);
+        if (!flowTo(0, entry, 0))
+            return fail(result);
+
+        while (!worklist.empty()) {
+            size_t pc = worklist.back();
+            worklist.pop_back();
+            if (!step(pc))
+                return fail(result);
+        }
+
+        result.verified = true;
+        result.maxStackDepth = maxDepth;
+        result.depths.assign(code.size(), Verification::UNREACHED);
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            if (visited[pc])
+                result.depths[pc] = static_cast<uint32_t>(states[pc].depth);
+        }
+        return result;
+    }
+
+private:
+    // Applies one instruction to its entry state and propagates the result.
+    bool step(size_t pc) {
+        const Instruction& insn = code[pc];
+        State s = states[pc];
+
+        switch (insn.op) {
+            case PUSH:
+                grow(s, 1);
+                return flowTo(pc + 1, s, pc);
+            case ADD:
+            case OP_COMPARE:
+                if (!pop(pc, s, 2, insn.op == ADD ? "ADD" : "OP_COMPARE"))
+                    return false;
+                grow(s, 1);
+                return flowTo(pc + 1, s, pc);
+            case PRINT:
+            case PRINT_NO_NL:
+                if (s.buffer == STR_UNKNOWN)
+                    return error(pc, "cannot tell whether PRINT pops: string buffer may or may not be set");
+                if (s.buffer == STR_SET) {
+                    s.buffer = STR_EMPTY;
+                    s.operand = STR_EMPTY;
+                } else if (!pop(pc, s, 1, "PRINT")) {
+                    return false;
+                }
+                return flowTo(pc + 1, s, pc);
+            case PRINTLN:
+                // Only a pending string is printed and cleared, together with
+                // the operand; with an empty buffer a TO_STRING result stays.
+                s.depth = 0;
+                if (s.buffer == STR_SET)
+                    s.operand = STR_EMPTY;
+                else if (s.buffer == STR_UNKNOWN)
+                    s.operand = STR_UNKNOWN;
+                s.buffer = STR_EMPTY;
+                return flowTo(pc + 1, s, pc);
+            case PUSH_VAR:
+            case OP_INPUT:
+                s.defined[insn.arg] = true;
+                return flowTo(pc + 1, s, pc);
+            case LOAD_VAR:
+                if (!requireDefined(pc, s, insn.arg))
+                    return false;
+                grow(s, 1);
+                return flowTo(pc + 1, s, pc);
+            case PRINT_VAR:
+                return requireDefined(pc, s, insn.arg) && flowTo(pc + 1, s, pc);
+            case JUMP_IF_ZERO:
+                return pop(pc, s, 1, "JUMP_IF_ZERO") && flowTo(pc + 1, s, pc) && flowTo(insn.arg, s, pc);
+            case JUMP:
+                return flowTo(insn.arg, s, pc);
+            case OP_LOAD_STRING:
+                s.buffer = insn.len > 0 ? STR_SET : STR_EMPTY;
+                return flowTo(pc + 1, s, pc);
+            case OP_TO_STRING:
+                if (!pop(pc, s, 1, "OP_TO_STRING"))
+                    return false;
+                s.operand = STR_SET;
+                return flowTo(pc + 1, s, pc);
+            case OP_CONCAT:
+                if (s.buffer == STR_SET || s.operand == STR_SET)
+                    s.buffer = STR_SET;
+                else if (s.buffer == STR_UNKNOWN || s.operand == STR_UNKNOWN)
+                    s.buffer = STR_UNKNOWN;
+                return flowTo(pc + 1, s, pc);
+            case NOP:
+                return flowTo(pc + 1, s, pc);
+            case OP_PRINT_LITERAL_RUN:
+                if (s.buffer == STR_UNKNOWN)
+                    return error(pc, "cannot tell whether PRINT pops: string buffer may or may not be set");
+                if (s.buffer == STR_SET) {
+                    // The first PRINT flushes the string and leaves its char pushed.
+                    s.buffer = STR_EMPTY;
+                    s.operand = STR_EMPTY;
+                    grow(s, insn.len > 1 ? 2 : 1);
+                    if (insn.len > 1)
+                        --s.depth;
+                } else {
+                    grow(s, 1);
+                    --s.depth;
+                }
+                return flowTo(pc + 1, s, pc);
+            case OP_COMPARE_VAR_IMM_BRANCH:
+                if (!requireDefined(pc, s, insn.len))
+                    return false;
+                grow(s, 2);
+                s.depth -= 2;
+                return flowTo(pc + 1, s, pc) && flowTo(insn.arg, s, pc);
+            case OP_HALT:
+                return true;
+            case OP_TRAP:
+            default:
+                return error(pc, "unsupported opcode " + std::to_string(insn.imm) + " is reachable");
+        }
+    }
+
+    // Stack growth is bounded by construction: a loop that grows the stack
+    // reaches its header with two different depths and fails in flowTo().
+    void grow(State& s, size_t cells) {
+        s.depth += cells;
+        if (s.depth > maxDepth)
+            maxDepth = s.depth;
+    }
+
+    bool pop(size_t pc, State& s, size_t cells, const char* what) {
+        if (s.depth < cells) {
+            return error(pc, std::string("stack underflow in ") + what + " (depth " +
+                             std::to_string(s.depth) + ", needs " + std::to_string(cells) + ")");
+        }
+        s.depth -= cells;
+        return true;
+    }
+
+    bool requireDefined(size_t pc, const State& s, size_t slot) {
+        if (!s.defined[slot])
+            return error(pc, "variable '" + program.slotName(slot) + "' may be read before it is assigned");
+        return true;
+    }
+
+    // Merges `s` into the entry state of `target`, queueing it if it changed.
+    bool flowTo(size_t target, const State& s, size_t from) {
+        if (!visited[target]) {
+            visited[target] = true;
+            states[target] = s;
+            worklist.push_back(target);
+            return true;
+        }
+        State& known = states[target];
+        if (known.depth != s.depth) {
+            return error(target, "stack depth differs between paths (" + std::to_string(known.depth) +
+                                 " vs " + std::to_string(s.depth) + " from pc " + std::to_string(from) + ")");
+        }
+        bool changed = false;
+        if (known.buffer != s.buffer && known.buffer != STR_UNKNOWN) {
+            known.buffer = STR_UNKNOWN;
+            changed = true;
+        }
+        if (known.operand != s.operand && known.operand != STR_UNKNOWN) {
+            known.operand = STR_UNKNOWN;
+            changed = true;
+        }
+        for (size_t i = 0; i < known.defined.size(); ++i) {
+            if (known.defined[i] && !s.defined[i]) {
+                known.defined[i] = false;
+                changed = true;
+            }
+        }
+        if (changed)
+            worklist.push_back(target);
+        return true;
+    }
+
+    bool error(size_t pc, const std::string& reason) {
+        failPc = pc;
+        failReason = reason;
+        return false;
+    }
+
+    Verification& fail(Verification& result) {
+        result.verified = false;
+        result.pc = failPc;
+        std::ostringstream message;
+        message << "pc " << failPc << " (byte " << program.byteOffset(failPc) << "): " << failReason;
+        result.reason = message.str();
+        return result;
+    }
+
+    const Program& program;
+    const std::vector<Instruction>& code;
+    std::vector<State> states;
+    std::vector<bool> visited;
+    std::vector<size_t> worklist;
+    size_t maxDepth = 0;
+    size_t failPc = 0;
+    std::string failReason;
+};
+
+} // namespace
+
+// Abstract interpretation over the control-flow graph: every instruction gets
+// one stack depth, shared by all paths reaching it, plus what is known about
+// the string buffers and which variables are assigned. A program that passes
+// cannot overflow a stack of maxStackDepth cells, underflow, or read an
+// unassigned variable, so it may run with those checks compiled out.
+void Program::verify() {
+    verifyResult = Verifier(*this).run();
+}
@@ -4,10 +4,16 @@
 #include <cstdint>
 #include <stdexcept>
 #include <sstream>
+#include <iterator>
 #include <algorithm>
+#include <memory>
 #include <cctype>
-#include <unordered_map>
+#include <cerrno>
+#include <unistd.h>
 #include "vm.h"
+#include "compilecache.h"
+#include "jit.h"
+#include "loader.h"
 #include "utils.h"
 
 // Cập nhật hàm đọc magic number với xử lý endianness
@@ -29,300 +35,349 @@ uint32_t readMagicNumber(const std::string& filename) {
     return magic;
 }
 
+// Writes a message from the VM itself, rather than the program, to the
+// run's output.
+static void writeOutput(const RunOptions& options, const std::string& text) {
+    OutputBuffer out;
+    if (options.output != NULL)
+        out.captureTo(options.output);
+    out.write(text.data(), text.size());
+}
+
 // Hàm thực thi Java bytecode (mock)
-void executeJavaBytecode() {
-    std::cout << "Detected Java bytecode - forwarding to JVM..." << std::endl;
+void executeJavaBytecode(const RunOptions& options) {
+    writeOutput(options, "Detected Java bytecode - forwarding to JVM...\n");
     // ...existing code or mock xử lý...
 }
 
-// Updated executeCustomBytecode with new opcodes support
-void executeCustomBytecode(std::istream& file) {
-    VirtualMachine vm;
-    uint8_t opcode;
-    
-    while (file.read(reinterpret_cast<char*>(&opcode), sizeof(opcode))) {
-        switch (opcode) {
-            case PUSH: {
-                uint8_t value;
-                file.read(reinterpret_cast<char*>(&value), sizeof(value));
-                vm.push(value);
-                break;
-            }
-            case ADD: {
-                vm.add();
-                break;
-            }
-            case PRINT: {
-                vm.print();
-                break;
-            }
-            case PRINTLN: {
-                vm.println();
-                break;
-            }
-            case PRINT_NO_NL: {
-                vm.printNoNewline();
-                break;
-            }
-            case PUSH_VAR: {  // expects two bytes: var id and immediate value
-                uint8_t varId, imm;
-                file.read(reinterpret_cast<char*>(&varId), sizeof(varId));
-                file.read(reinterpret_cast<char*>(&imm), sizeof(imm));
-                std::string varName(1, static_cast<char>(varId)); // Convert char to string
-                vm.variables[varName] = imm;
-                break;
-            }
-            case LOAD_VAR: {  // expects one byte: var id
-                uint8_t varId;
-                file.read(reinterpret_cast<char*>(&varId), sizeof(varId));
-                std::string varName(1, static_cast<char>(varId)); // Convert char to string
-                if (vm.variables.find(varName) == vm.variables.end())
-                    throw std::runtime_error("Variable not defined.");
-                vm.push(vm.variables[varName]);
-                break;
-            }
-            case OP_INPUT: { // Handle input for a variable.
-                uint8_t nameLength;
-                file.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength));
-                std::string varName;
-                for (uint8_t i = 0; i < nameLength; ++i) {
-                    char c;
-                    file.read(&c, sizeof(c));
-                    varName.push_back(c);
-                }
+// Runs one engine on the given input with output captured in memory, and
+// returns everything observable about the run: output, error and final state.
+static std::string runCaptured(const Program& program, const RunOptions& options, Engine engine,
+                               const std::string& input) {
+    std::string out;
+    RunOptions captured = options;
+    captured.input = &input;
+    captured.output = &out;
+    VirtualMachine vm(captured);
+    std::string error;
+    try {
+        vm.execute(program, engine);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    vm.output().flush();
+    return "output: " + out + "\nerror: " + error + "\n" + vm.dumpState();
+}
 
-                // Ensure the variable is initialized in memory.
-                if (vm.variables.find(varName) == vm.variables.end()) {
-                    vm.variables[varName] = 0; // Default initialization to 0.
-                }
+// Reads all of stdin, or nothing from an interactive terminal.
+static std::string readStdin() {
+    std::string input;
+    if (isatty(STDIN_FILENO))
+        return input;
+    char chunk[4096];
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return input;
+        input.append(chunk, static_cast<size_t>(n));
+    }
+}
 
-                // Read input from the user.
-                std::string userInput;
-                std::getline(std::cin, userInput);
-                int value = 0;
-                try {
-                    value = std::stoi(userInput);
-                } catch (...) {
-                    value = 0; // Default to 0 if input is invalid.
-                }
+// Fails the differential check if a variant's run differs from the reference.
+static void expectSame(const std::string& reference, const std::string& name, const std::string& result,
+                       const RunOptions& options) {
+    if (result == reference)
+        return;
+    options.log() << "--- " << engineName(ENGINE_SWITCH) << "\n" << reference << "\n"
+                  << "--- " << name << "\n" << result << std::endl;
+    throw std::runtime_error("Engine mismatch: " + name + " differs from " + engineName(ENGINE_SWITCH));
+}
 
-                // Store the input value in memory.
-                vm.variables[varName] = static_cast<uint8_t>(value);
-                break;
-            }
-            case JUMP_IF_ZERO: {
-                uint8_t offset_high, offset_low;
-                file.read(reinterpret_cast<char*>(&offset_high), sizeof(offset_high));
-                file.read(reinterpret_cast<char*>(&offset_low), sizeof(offset_low));
-                int offset = (offset_high << 8) | offset_low;
-                if (vm.isStackEmpty())
-                    throw std::runtime_error("Stack underflow for jump condition.");
-                uint8_t cond = vm.topStack();
-                vm.popStack();
-                // If the condition is zero then skip the next 'offset' bytes.
-                if (cond == 0) {
-                    std::streampos pos = file.tellg();
-                    file.seekg(pos + static_cast<std::streamoff>(offset));
-                }
-                break;
-            }
-            case JUMP: {
-                uint8_t offset_high, offset_low;
-                file.read(reinterpret_cast<char*>(&offset_high), sizeof(offset_high));
-                file.read(reinterpret_cast<char*>(&offset_low), sizeof(offset_low));
-                int offset = (offset_high << 8) | offset_low;
-                std::streampos pos = file.tellg();
-                file.seekg(pos + static_cast<std::streamoff>(offset));
-                break;
-            }
-            case PRINT_VAR: {
-                uint8_t varId;
-                file.read(reinterpret_cast<char*>(&varId), sizeof(varId));
-                std::string varName(1, static_cast<char>(varId)); // Convert char to string
-                if (vm.variables.find(varName) == vm.variables.end())
-                    throw std::runtime_error("Variable not defined for PRINT_VAR.");
-                int num = vm.variables[varName];
-                // Convert number to string and print directly.
-                std::cout << std::to_string(num);
-                break;
-            }
-            case 0x50: { // OP_LOAD_STRING: read string literal
-                uint8_t len;
-                file.read(reinterpret_cast<char*>(&len), sizeof(len));
-                std::string lit;
-                for (int i = 0; i < len; i++) {
-                    char ch;
-                    file.read(&ch, sizeof(ch));
-                    lit.push_back(ch);
-                }
-                vm.strBuffer = lit;
-                break;
-            }
-            case 0x51: { // OP_TO_STRING: pop numeric value and convert to string
-                if (vm.isStackEmpty())
-                    throw std::runtime_error("Stack underflow in OP_TO_STRING");
-                uint8_t val = vm.topStack();
-                vm.popStack();
-                vm.strOperand = std::to_string(val);
-                break;
-            }
-            case 0x52: { // OP_CONCAT: concatenate the literal and converted value
-                vm.strBuffer = vm.strBuffer + vm.strOperand;
-                break;
-            }
-            case 0x53: { // OP_COMPARE: pop two numbers, push 1 if first > second, else 0
-                if (vm.getStackSize() < 2)
-                    throw std::runtime_error("Stack underflow in OP_COMPARE");
-                uint8_t b = vm.topStack();
-                vm.popStack();
-                uint8_t a = vm.topStack();
-                vm.popStack();
-                vm.push(a > b ? 1 : 0);
-                break;
-            }
-            case 0x1F: {
-                // Handle stray opcode (0x1F) as a no-op.
-                break;
-            }
-            default:
-                throw std::runtime_error("Unsupported opcode: " + std::to_string(opcode));
+// Differential check: every engine, with and without superinstructions, must
+// produce the same output, error and final VM state as the reference switch
+// engine on the unfused program for the same input.
+static void compareEngines(const Program& decoded, const RunOptions& options) {
+    // Both engines see the same input; an interactive terminal supplies none.
+    std::string input = options.input != NULL ? *options.input : readStdin();
+
+    // The reference is never verified, so it always runs with checks on.
+    Program variants[3] = { decoded, decoded, decoded };
+    const char* variantNames[3] = { "", "+verified", "+fused+verified" };
+    variants[1].verify();
+    variants[2].fuse();
+    variants[2].verify();
+    variants[1].lowerToRegisters();
+    variants[2].lowerToRegisters();
+    RunOptions interpreted = options;
+    interpreted.jit = JIT_OFF;
+    std::string reference = runCaptured(decoded, interpreted, ENGINE_SWITCH, input);
+
+    const Engine engines[] = { ENGINE_SWITCH, ENGINE_THREADED, ENGINE_REGISTER };
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); ++i) {
+        for (size_t v = 0; v < 3; ++v) {
+            std::string name = std::string(engineName(engines[i])) + variantNames[v];
+            expectSame(reference, name, runCaptured(variants[v], interpreted, engines[i], input), options);
         }
     }
+    std::string agreeing = std::string(engineName(ENGINE_SWITCH)) + ", " + engineName(ENGINE_THREADED) +
+                           ", " + engineName(ENGINE_REGISTER);
+
+    // Native code only runs verified programs, from the first instruction.
+    if (CVM_HAVE_JIT) {
+        RunOptions native = options;
+        native.jit = JIT_FORCE;
+        for (size_t v = 1; v < 3; ++v) {
+            std::string name = std::string("jit") + variantNames[v];
+            expectSame(reference, name, runCaptured(variants[v], native, ENGINE_SWITCH, input), options);
+        }
+        agreeing += ", jit";
+    }
+    writeOutput(options, "Engines agree: " + agreeing + " (with and without fusion and verification)\n");
 }
 
-// Updated runVM to support ASCII hex bytecode (with or without "0x" prefix)
-void runVM(const std::string& filename) {
-    std::string inputFile = filename;
-    // If the input file has a .covi extension, compile it using covicc to produce DEFCAA bytecode.
+// Load-time statistics for --stats, written to the run's diagnostics.
+static void printStats(std::ostream& log, const Program& program, size_t decodedCount) {
+    log << "[stats] instructions: " << decodedCount << " decoded, "
+              << program.instructions().size() << " after fusion" << std::endl;
+    const std::vector<FusionCounter>& fusions = program.fusionCounters();
+    for (size_t i = 0; i < fusions.size(); ++i) {
+        log << "[stats] fusion " << fusions[i].name << ": " << fusions[i].sites
+                  << " sites, " << fusions[i].folded << " instructions folded" << std::endl;
+    }
+    const Verification& verification = program.verification();
+    if (verification.verified)
+        log << "[stats] verifier: passed, max stack depth " << verification.maxStackDepth << std::endl;
+    else if (!verification.reason.empty())
+        log << "[stats] verifier: failed at " << verification.reason << std::endl;
+    else
+        log << "[stats] verifier: not run" << std::endl;
+    if (const RegisterCode* registers = program.registerCode()) {
+        log << "[stats] register IR: " << registers->code.size() << " instructions, "
+            << registers->registerCount << " registers" << std::endl;
+    }
+}
+
+ProgramRef loadProgram(const uint8_t* code, size_t size, const RunOptions& options) {
+    std::shared_ptr<Program> program = std::make_shared<Program>(Program::decode(code, size));
+    size_t decodedCount = program->instructions().size();
+    if (options.fuse)
+        program->fuse();
+    if (options.verify || options.strictVerify) {
+        program->verify();
+        const Verification& verification = program->verification();
+        if (options.strictVerify && !verification.verified)
+            throw std::runtime_error("Verification failed at " + verification.reason);
+        if (options.engine == ENGINE_REGISTER)
+            program->lowerToRegisters();
+    }
+    if (options.stats)
+        printStats(options.log(), *program, decodedCount);
+    return program;
+}
+
+std::unique_ptr<BytecodeImage> openImage(const std::string& filename, const RunOptions& options) {
+    std::unique_ptr<BytecodeImage> image;
+    // .covi sources are compiled in-process, through the compile cache unless
+    // it is disabled; nothing is written next to the source.
     if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".covi") {
-        std::string outputFile = filename.substr(0, filename.size()-5) + ".cb";
-        std::string command = "covicc " + filename + " -o " + outputFile;
-        if (system(command.c_str()) != 0) {
-            throw std::runtime_error("Compilation using covicc failed.");
-        }
-        inputFile = outputFile;
+        if (options.compileCache)
+            image = CompileCache(options.cacheDir).load(filename, options.stats ? &options.log() : NULL);
+        else
+            image = CompileCache::compile(filename);
+    } else {
+        // Binary images are decoded straight from the mapped file; only ASCII
+        // hex images need a decoded copy.
+        image.reset(new BytecodeImage(filename));
+        image->decodeAsciiHex();
     }
-    
-    std::vector<uint8_t> fileData = readFile(inputFile);
-    
-    // Check if fileData is entirely ASCII hex (allowing whitespace and "x" or "X")
-    bool asciiHex = true;
-    for (auto c : fileData) {
-        if (!std::isspace(c) && !((c >= '0' && c <= '9') ||
-            (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f') ||
-            (c == 'x' || c == 'X'))) {
-            asciiHex = false;
-            break;
+
+    if (image->size() < 4)
+        throw std::runtime_error("Bytecode file too small to contain magic number");
+    return image;
+}
+
+uint32_t imageMagic(const BytecodeImage& image) {
+    const uint8_t* bytes = image.data();
+    return (static_cast<uint32_t>(bytes[0]) << 24) |
+           (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8)  |
+           (static_cast<uint32_t>(bytes[3]));
+}
+
+// Updated runVM to support ASCII hex bytecode (with or without "0x" prefix)
+void runVM(const std::string& filename, const RunOptions& options) {
+    std::unique_ptr<BytecodeImage> image = openImage(filename, options);
+    uint32_t magic = imageMagic(*image);
+
+    if (magic == JAVA_MAGIC) {
+        executeJavaBytecode(options);
+    } else if (magic == CUSTOM_MAGIC) {
+        const uint8_t* code = image->data() + 4;
+        size_t size = image->size() - 4;
+        if (options.differential) {
+            compareEngines(Program::decode(code, size), options);
+            return;
         }
-    }
-    
-    if (asciiHex && !fileData.empty()) {
-        std::string content(fileData.begin(), fileData.end());
-        std::istringstream iss(content);
-        std::string token, hexJoined;
-        while (iss >> token) {
-            if (token.size() >= 2 && (token.substr(0,2) == "0x" || token.substr(0,2) == "0X"))
-                token = token.substr(2);
-            hexJoined += token;
+        ProgramRef program = loadProgram(code, size, options);
+        VirtualMachine vm(program, options);
+        if (options.profile == PROFILE_OFF) {
+            vm.run();
+            return;
         }
-        if (hexJoined.size() % 2 != 0)
-            throw std::runtime_error("Invalid ASCII hex bytecode: odd length");
-        std::vector<uint8_t> bin;
-        for (size_t i = 0; i < hexJoined.size(); i += 2) {
-            std::string byteStr = hexJoined.substr(i, 2);
-            uint8_t byte = static_cast<uint8_t>(std::stoul(byteStr, nullptr, 16));
-            bin.push_back(byte);
+        // The profile is reported even when the program stops with an error.
+        Profiler profiler(*program);
+        vm.setProfiler(&profiler);
+        try {
+            vm.run();
+        } catch (...) {
+            vm.output().flush();
+            profiler.report(options.log(), options.profile);
+            throw;
         }
-        fileData = bin;
-    }
-    
-    if (fileData.size() < 4)
-        throw std::runtime_error("Bytecode file too small to contain magic number");
-    
-    uint32_t magic = (static_cast<uint32_t>(fileData[0]) << 24) |
-                     (static_cast<uint32_t>(fileData[1]) << 16) |
-                     (static_cast<uint32_t>(fileData[2]) << 8)  |
-                     (static_cast<uint32_t>(fileData[3]));
-    
-    std::istringstream iss(std::string(fileData.begin() + 4, fileData.end()), std::ios::binary);
-    
-    if (magic == JAVA_MAGIC)
-        executeJavaBytecode();
-    else if (magic == CUSTOM_MAGIC)
-        executeCustomBytecode(iss);
-    else
+        profiler.report(options.log(), options.profile);
+    } else {
         throw std::runtime_error("Invalid magic number: " + std::to_string(magic));
+    }
 }
 
 // Định nghĩa các phương thức cho custom bytecode
-VirtualMachine::VirtualMachine() {
+RunOptions::RunOptions()
+    : engine(CVM_DEFAULT_ENGINE), differential(false),
+      stackSize(VirtualMachine::MAX_STACK_SIZE), wideCells(false), unbuffered(false),
+      fuse(true), verify(true), strictVerify(false), stats(false), compileCache(true),
+      profile(PROFILE_OFF), jit(JIT_OFF), input(NULL), output(NULL), diagnostics(NULL) {}
+
+std::ostream& RunOptions::log() const {
+    return diagnostics != NULL ? *diagnostics : std::cerr;
+}
+
+// Renders the stack (bottom to top), variables and string buffers so two
+// runs can be compared for equality.
+std::string VirtualMachine::dumpState() const {
+    std::ostringstream out;
+    out << "stack:";
+    for (const Value* cell = stackBase; cell != sp; ++cell)
+        out << ' ' << *cell;
+    std::vector<std::pair<std::string, Value> > vars;
+    for (size_t slot = 0; slot < variables.size(); ++slot) {
+        if (variables[slot].defined)
+            vars.push_back(std::make_pair(program->slotName(slot), variables[slot].value));
+    }
+    std::sort(vars.begin(), vars.end());
+    out << "\nvariables:";
+    for (size_t i = 0; i < vars.size(); ++i)
+        out << ' ' << vars[i].first << '=' << vars[i].second;
+    out << "\nstrBuffer: " << strBuffer.str() << "\nstrOperand: " << strOperand.str() << '\n';
+    return out.str();
+}
+
+VirtualMachine::VirtualMachine(const RunOptions& options)
+    : engine(options.engine), program(NULL), stackStorage(options.stackSize),
+      valueMask(options.wideCells ? ~static_cast<Value>(0) : static_cast<Value>(0xFF)),
+      profiler(NULL), jitMode(options.jit), jitGeneration(0) {
     // ...existing code nếu cần khởi tạo...
-    strBuffer = "";
-    strOperand = "";
+    stackBase = stackStorage.data();
+    sp = stackBase;
+    stackLimit = stackBase + options.stackSize;
+    out.setUnbuffered(options.unbuffered);
+    if (options.output != NULL)
+        out.captureTo(options.output);
+    if (options.input != NULL)
+        in.readFrom(options.input);
 }
 
-void VirtualMachine::push(uint8_t value) {
-    if (stack.size() >= MAX_STACK_SIZE)
-        throw std::runtime_error("Stack overflow detected!");
-    stack.push(value);
+VirtualMachine::VirtualMachine(ProgramRef program, const RunOptions& options)
+    : VirtualMachine(options) {
+    bound = program;
+    variables.assign(bound->slotCount(), Variable());
+}
+
+VirtualMachine::~VirtualMachine() {}
+
+void VirtualMachine::run() {
+    if (!bound)
+        throw std::runtime_error("No program bound to this VM");
+    execute(*bound, engine);
+}
+
+void VirtualMachine::reset() {
+    out.flush();
+    sp = stackBase;
+    strBuffer.clear();
+    strOperand.clear();
+    variables.assign(bound ? bound->slotCount() : 0, Variable());
+    // Compiled code for the bound program stays valid and is kept.
+    jitError = std::exception_ptr();
 }
 
 void VirtualMachine::add() {
-    if (stack.size() < 2)
+    if (getStackSize() < 2)
         throw std::runtime_error("Stack underflow detected while performing ADD!");
-    uint8_t a = stack.top();
-    stack.pop();
-    uint8_t b = stack.top();
-    stack.pop();
-    uint8_t result = a + b;
-    stack.push(result);
+    Value a = *--sp;
+    Value b = *--sp;
+    *sp++ = (a + b) & valueMask;
+}
+
+// Prints the pending concatenated string and clears both string buffers.
+void VirtualMachine::printStrings() {
+    strBuffer.writeTo(out);
+    strBuffer.clear();
+    strOperand.clear();
 }
 
 void VirtualMachine::print() {
     // If a concatenated string is present, print it and clear both buffers.
     if (!strBuffer.empty()){
-        std::cout << strBuffer;
-        strBuffer.clear();
-        strOperand.clear();
+        printStrings();
         return;
     }
-    if (stack.empty())
+    if (isStackEmpty())
         throw std::runtime_error("Stack underflow detected while performing PRINT!");
-    std::cout << static_cast<char>(stack.top());
-    stack.pop();
+    out.put(static_cast<char>(*--sp));
+}
+
+// OP_INPUT: reads a line and parses it as a number, 0 if it is not one.
+Value VirtualMachine::readInputValue() {
+    // Any pending prompt must be visible first.
+    out.flush();
+    in.readLine(inputLine);
+    long long value = 0;
+    try {
+        value = wideCells() ? std::stoll(inputLine) : std::stoi(inputLine);
+    } catch (...) {
+        value = 0; // Default to 0 if input is invalid.
+    }
+    return static_cast<Value>(value) & valueMask;
 }
 
 void VirtualMachine::println() {
     // Before printing, clear any leftover concatenation buffers.
-    if (!strBuffer.empty()){
-        std::cout << strBuffer;
-        strBuffer.clear();
-        strOperand.clear();
-    }
-    if (stack.empty()) {
-        std::cout << std::endl;
-    } else {
-        std::vector<char> temp;
-        while (!stack.empty()) {
-            temp.push_back(static_cast<char>(stack.top()));
-            stack.pop();
-        }
-        std::reverse(temp.begin(), temp.end());
-        for (char c : temp)
-            std::cout << c;
-        std::cout << std::endl;
+    if (!strBuffer.empty())
+        printStrings();
+    // The stack is contiguous, so its contents go out bottom to top as one
+    // span, narrowed to bytes a chunk at a time (one chunk for the default
+    // stack size), and the whole stack is then dropped at once.
+    char span[MAX_STACK_SIZE];
+    const Value* cell = stackBase;
+    while (cell != sp) {
+        size_t n = std::min(static_cast<size_t>(sp - cell), sizeof(span));
+        for (size_t i = 0; i < n; ++i)
+            span[i] = static_cast<char>(cell[i]);
+        out.write(span, n);
+        cell += n;
     }
+    sp = stackBase;
+    out.newline();
 }
 
 void VirtualMachine::printNoNewline() {
     if (!strBuffer.empty()){
-        std::cout << strBuffer;
-        strBuffer.clear();
-        strOperand.clear();
+        printStrings();
         return;
     }
-    if (stack.empty())
+    if (isStackEmpty())
         throw std::runtime_error("Stack underflow detected while performing PRINT (no newline)!");
-    std::cout << static_cast<char>(stack.top());
-    stack.pop();
-}
\ No newline at end of file
+    out.put(static_cast<char>(*--sp));
+}
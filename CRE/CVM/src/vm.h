@@ -2,13 +2,18 @@
 #define VM_H
 
 #include <cstdint>
+#include <exception>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <fstream>
-#include <stack>
 #include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include "input.h"
+#include "output.h"
+#include "profiler.h"
+#include "program.h"
+#include "stringvalue.h"
 
 // Define magic numbers for bytecode identification.
 const uint32_t JAVA_MAGIC = 0xCAFEBABE;
@@ -21,6 +26,7 @@ enum Opcode {
     PRINT = 0x03,
     PRINTLN = 0x0A,
     PRINT_NO_NL = 0x1A,
+    NOP = 0x1F,        // Stray opcode, executed as a no-op.
 
     // Variables and jump opcodes.
     PUSH_VAR = 0x11,
@@ -37,48 +43,193 @@ enum Opcode {
     OP_COMPARE     = 0x53  // Compare: if first > second, push 1; else push 0.
 };
 
-// Minimal Virtual Machine class supporting custom bytecode.
+// Dispatch engines for executing a decoded program.
+enum Engine {
+    ENGINE_SWITCH,   // Portable switch loop; the reference engine.
+    ENGINE_THREADED, // Computed-goto dispatch (GCC/Clang labels-as-values).
+    ENGINE_REGISTER  // Register IR (regir.h) for verified programs; switch otherwise.
+};
+
+#if defined(__GNUC__)
+#define CVM_HAVE_THREADED_DISPATCH 1
+#else
+#define CVM_HAVE_THREADED_DISPATCH 0
+#endif
+
+// Engine used when none is requested on the command line (make ENGINE=threaded).
+#ifndef CVM_DEFAULT_ENGINE
+#define CVM_DEFAULT_ENGINE ENGINE_SWITCH
+#endif
+
+const char* engineName(Engine engine);
+
+// When verified programs are translated to native code (see jit.h).
+enum JitMode {
+    JIT_OFF,
+    JIT_FORCE  // Before the first instruction.
+};
+
+// Name of an Opcode or InternalOpcode, for reports.
+const char* opcodeName(uint8_t op);
+
+// One operand stack cell or variable value.
+typedef uint64_t Value;
+
+// Options controlling how runVM executes a bytecode file.
+struct RunOptions {
+    RunOptions();
+    Engine engine;
+    bool differential;  // Run every engine and compare output and final state.
+    size_t stackSize;   // Operand stack capacity in cells.
+    bool wideCells;     // 64-bit arithmetic instead of 8-bit wrap-around.
+    bool unbuffered;    // Write output through on every PRINT-family opcode.
+    bool fuse;          // Rewrite common sequences into superinstructions.
+    bool verify;        // Verify at load time; verified programs skip runtime checks.
+    bool strictVerify;  // Reject programs that fail verification.
+    bool stats;         // Print load statistics to stderr.
+    bool compileCache;  // Reuse compiled .covi images across runs.
+    std::string cacheDir; // Compile cache location; empty for the default.
+    ProfileFormat profile; // Per-opcode profile printed when the run ends.
+    JitMode jit;         // Native code for verified programs; ignored while profiling.
+
+    // Where a run reads and writes. By default: stdin, stdout and stderr. The
+    // batch runner points every job at its own strings, so no two runs
+    // share a stream.
+    const std::string* input;  // OP_INPUT lines; NULL reads stdin.
+    std::string* output;       // Program output; NULL writes to stdout.
+    std::ostream* diagnostics; // --stats and --differential reports; NULL for stderr.
+    std::ostream& log() const;
+};
+
+// A loaded program. Decoding, fusion and verification happen once in
+// loadProgram(); afterwards the Program is never modified, so one instance
+// can back any number of VirtualMachines, on any number of threads.
+typedef std::shared_ptr<const Program> ProgramRef;
+
+// Decodes the instruction bytes that follow the magic number and applies
+// the load-time passes selected in `options`.
+ProgramRef loadProgram(const uint8_t* code, size_t size, const RunOptions& options = RunOptions());
+
+class JitCode;
+struct JitFrame;
+
+// Execution context for one running instance of a program. It holds only
+// per-instance state: the operand stack, variable slots, string buffers and
+// output. Instructions and constants stay in the shared Program.
 class VirtualMachine {
 public:
-    VirtualMachine();
-    void push(uint8_t value);
+    static const size_t MAX_STACK_SIZE = 256; // Default stack limit.
+
+    // The stack is allocated once, `options.stackSize` cells deep. Unless
+    // `options.wideCells` is set, arithmetic wraps at 8 bits exactly like the
+    // original byte stack.
+    explicit VirtualMachine(const RunOptions& options = RunOptions());
+
+    // A context bound to `program`, ready to run().
+    explicit VirtualMachine(ProgramRef program, const RunOptions& options = RunOptions());
+    ~VirtualMachine();
+
+    // Runs the bound program from its first instruction on options.engine.
+    void run();
+
+    // Returns to the state of a fresh context: empty stack, no variables
+    // defined, empty string buffers. Pending output is flushed, not dropped.
+    void reset();
+    void push(Value value) {
+        if (sp == stackLimit)
+            throw std::runtime_error("Stack overflow detected!");
+        *sp++ = value;
+    }
+    bool wideCells() const { return valueMask != 0xFF; }
     void add();
     void print();            // PRINT: output without newline.
     void println();          // PRINTLN: output then newline.
     void printNoNewline();   // PRINT without newline.
 
-    VirtualMachine(const std::string& bytecodeFile);
-    void execute();
+    // Runs a decoded program to completion on the given engine.
+    void execute(const Program& program, Engine engine = CVM_DEFAULT_ENGINE);
 
-    // Variable table mapping variable name (string) to its value.
-    std::unordered_map<std::string, uint8_t> variables;
+    // Buffered output written by the PRINT-family opcodes.
+    OutputBuffer& output() { return out; }
+    // Lines read by OP_INPUT.
+    InputSource& input() { return in; }
+
+    // Records every dispatch into `profiler` until reset to NULL. Without
+    // one, execute() runs engines built with no profiling code.
+    void setProfiler(Profiler* profiler) { this->profiler = profiler; }
+
+    // Human-readable dump of the stack, variables and string buffers.
+    std::string dumpState() const;
+
+    // Variable storage, indexed by the slot numbers Program::decode assigned.
+    // Names live in the Program and are only looked up for diagnostics.
+    struct Variable {
+        Value value;
+        bool defined;
+    };
+    std::vector<Variable> variables;
     
     // Accessors for the execution stack.
-    bool isStackEmpty() const { return stack.empty(); }
-    uint8_t topStack() const { return stack.top(); }
-    void popStack() { stack.pop(); }
-    size_t getStackSize() const { return stack.size(); }
+    bool isStackEmpty() const { return sp == stackBase; }
+    Value topStack() const { return sp[-1]; }
+    void popStack() { --sp; }
+    size_t getStackSize() const { return static_cast<size_t>(sp - stackBase); }
 
-    // For handling string concatenation opcodes.
-    std::string strBuffer;
-    std::string strOperand;
+    // For handling string concatenation opcodes. Literals in them point into
+    // the string pool of the Program last run, which must outlive them or
+    // be followed by reset().
+    StringValue strBuffer;
+    StringValue strOperand;
 
 private:
-    std::vector<uint8_t> bytecode;
-    std::stack<uint8_t> stack;
-    static const size_t MAX_STACK_SIZE = 256; // Example stack limit.
+    ProgramRef bound;       // Program run() executes, if any.
+    Engine engine;
+    const Program* program; // Program currently bound to the variable slots.
+    // Contiguous operand stack: cells live in [stackBase, sp), sp is the next
+    // free cell and stackLimit is one past the last usable cell.
+    std::vector<Value> stackStorage;
+    Value* stackBase;
+    Value* sp;
+    Value* stackLimit;
+    Value valueMask; // 0xFF in 8-bit mode, all ones with wide cells.
+    OutputBuffer out;
+    InputSource in;
+    std::string inputLine;  // Reused by every INPUT so a long line allocates once.
+    Profiler* profiler;
+
+    // JIT state.
+    friend class JitCode;
+    JitMode jitMode;
+    uint64_t jitGeneration;         // Program::generation() jitCode was compiled from; 0 if none.
+    std::unique_ptr<JitCode> jitCode;
+    std::exception_ptr jitError;    // Thrown by a helper called from native code.
 
     // ...existing helper functions for bytecode loading and execution...
-    void loadBytecode(const std::string& bytecodeFile);
-    void executeJavaBytecode();
-    void executeCustomBytecode();
+    template <bool Checked, bool Profiled> void dispatch(const Program& program, Engine engine, size_t start);
+    template <bool Checked, bool Profiled> void executeSwitch(const Program& program, size_t start);
+    template <bool Checked, bool Profiled> void executeThreaded(const Program& program, size_t start);
+    void executeVerified(const Program& program, Engine engine);
+    void executeRegisters(const Program& program);
+    Value readInputValue();
+    void executeOne(const Instruction* insn);
+    static int jitStep(JitFrame* frame, const Instruction* insn);
+    bool compileJit(const Program& program);
+    size_t runJit(size_t pc);
+    void printStrings();
     void handleCustomOpcode(uint8_t opcode);
     void checkStackOverflow();
     void checkStackUnderflow();
 };
 
+class BytecodeImage;
+
+// Opens a bytecode file, ASCII hex image or .covi source (compiled through
+// the compile cache) and returns its bytes, magic number included.
+std::unique_ptr<BytecodeImage> openImage(const std::string& filename, const RunOptions& options);
+uint32_t imageMagic(const BytecodeImage& image);
+
 // Runs the VM based on a bytecode file; handles both Java and custom bytecode.
-void runVM(const std::string& filename);
+void runVM(const std::string& filename, const RunOptions& options = RunOptions());
 
 // Utility function to throw standardized error messages.
 void throwError(const std::string& message);
@@ -0,0 +1,146 @@
+// Checks for the embedding API (src/libcvm.h). Run by `make test`.
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "libcvm.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAIL: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+std::vector<uint8_t> magic() {
+    std::vector<uint8_t> image;
+    image.push_back(0x00);
+    image.push_back(0xDE);
+    image.push_back(0xFC);
+    image.push_back(0xAA);
+    return image;
+}
+
+// A verified image that leaves `pushes` cells on the stack.
+std::vector<uint8_t> pushImage(size_t pushes) {
+    std::vector<uint8_t> image = magic();
+    for (size_t i = 0; i < pushes; ++i) {
+        image.push_back(PUSH);
+        image.push_back(static_cast<uint8_t>(i));
+    }
+    return image;
+}
+
+// A verified image that prints `text`, one PUSH; PRINT per character.
+std::vector<uint8_t> printImage(const std::string& text) {
+    std::vector<uint8_t> image = magic();
+    for (size_t i = 0; i < text.size(); ++i) {
+        image.push_back(PUSH);
+        image.push_back(static_cast<uint8_t>(text[i]));
+        image.push_back(PRINT);
+    }
+    return image;
+}
+
+// A second run() without reset() starts on the first run's stack, which the
+// verifier's bound does not cover, so it must keep its overflow checks.
+void runTwiceWithoutReset(Engine engine, JitMode jit) {
+    std::string name = std::string(engineName(engine)) + (jit == JIT_FORCE ? "+jit" : "");
+    std::vector<uint8_t> image = pushImage(200);
+    cvm::Options options;
+    options.engine = engine;
+    options.jit = jit;
+    cvm::ProgramRef program = cvm::loadImage(image.data(), image.size(), options);
+    cvm::Context context(program, options);
+
+    context.run();
+    check(context.getStackSize() == 200, name + ": first run leaves 200 cells");
+
+    bool overflowed = false;
+    try {
+        context.run();
+    } catch (const std::runtime_error& e) {
+        overflowed = std::string(e.what()) == "Stack overflow detected!";
+    }
+    check(overflowed, name + ": second run without reset() reports stack overflow");
+
+    context.reset();
+    context.run();
+    check(context.getStackSize() == 200, name + ": run after reset() leaves 200 cells");
+}
+
+// PRINTLN only clears strOperand along with a pending string. Here the
+// TO_STRING result survives it, the CONCAT makes a string pending, and the
+// next PRINT prints that instead of popping, so the program ends 257 cells
+// deep. The verifier must see that depth, so the run keeps its checks.
+void printlnKeepsOperand(Engine engine, JitMode jit) {
+    std::string name = std::string(engineName(engine)) + (jit == JIT_FORCE ? "+jit" : "");
+    std::vector<uint8_t> image = magic();
+    const uint8_t prefix[] = { PUSH, 5, OP_TO_STRING, PRINTLN, OP_CONCAT, PUSH, 'A', PRINT };
+    image.insert(image.end(), prefix, prefix + sizeof(prefix));
+    for (size_t i = 0; i < 256; ++i) {
+        image.push_back(PUSH);
+        image.push_back('1');
+    }
+    image.push_back(PRINTLN);
+
+    cvm::Options options;
+    options.engine = engine;
+    options.jit = jit;
+    cvm::ProgramRef program = cvm::loadImage(image.data(), image.size(), options);
+    const Verification& verification = program->verification();
+    check(!verification.verified || verification.maxStackDepth == 257,
+          name + ": verifier sees the stack 257 cells deep");
+
+    cvm::Context context(program, options);
+    std::string text;
+    context.output().captureTo(&text);
+    bool overflowed = false;
+    try {
+        context.run();
+    } catch (const std::runtime_error& e) {
+        overflowed = std::string(e.what()) == "Stack overflow detected!";
+    }
+    check(overflowed, name + ": 257th cell reports stack overflow");
+}
+
+// One context runs programs that are freed after each run, so a later one
+// may be allocated where an earlier one was. Each must get its own native
+// code.
+void jitAcrossPrograms() {
+    cvm::Options options;
+    options.jit = JIT_FORCE;
+    options.fuse = false;
+    cvm::Context context(options);
+    std::string text;
+    context.output().captureTo(&text);
+    const char* words[] = { "one", "two", "three" };
+    for (size_t i = 0; i < 3; ++i) {
+        std::vector<uint8_t> image = printImage(words[i]);
+        cvm::ProgramRef program = cvm::loadImage(image.data(), image.size(), options);
+        context.execute(*program);
+        context.reset();
+    }
+    check(text == "onetwothree", "jit: each program runs its own code, got \"" + text + "\"");
+}
+
+} // namespace
+
+int main() {
+    runTwiceWithoutReset(ENGINE_SWITCH, JIT_OFF);
+    runTwiceWithoutReset(ENGINE_THREADED, JIT_OFF);
+    runTwiceWithoutReset(ENGINE_REGISTER, JIT_OFF);
+    runTwiceWithoutReset(ENGINE_SWITCH, JIT_FORCE);
+    jitAcrossPrograms();
+    printlnKeepsOperand(ENGINE_SWITCH, JIT_OFF);
+    printlnKeepsOperand(ENGINE_THREADED, JIT_OFF);
+    printlnKeepsOperand(ENGINE_REGISTER, JIT_OFF);
+    printlnKeepsOperand(ENGINE_SWITCH, JIT_FORCE);
+    if (failures == 0)
+        std::printf("libcvm: all checks passed\n");
+    return failures == 0 ? 0 : 1;
+}
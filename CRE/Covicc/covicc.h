@@ -0,0 +1,17 @@
+#ifndef COVICC_H
+#define COVICC_H
+
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+// Compiler version. Part of cvm's compile-cache key, so bump it whenever
+// the generated bytecode changes.
+extern const char* const COVICC_VERSION;
+
+// Compiles a .covi source into a DEFCAA image, magic number included.
+// Throws std::runtime_error on syntax errors. Linked into covicc and, as
+// libcovicc.a, into cvm.
+std::vector<uint8_t> compileCovi(std::istream& source);
+
+#endif // COVICC_H
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include "arena.h"
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t size;
+    union {                 // Aligns data for any scalar type.
+        long double ld;
+        void *p;
+        long long ll;
+    } align;
+};
+
+#define ARENA_ALIGN sizeof(((ArenaChunk *)0)->align)
+
+static unsigned char *chunk_data(ArenaChunk *chunk) {
+    return (unsigned char *)&chunk->align;
+}
+
+// Appends a chunk of at least `size` bytes after the last one.
+static ArenaChunk *add_chunk(Arena *arena, size_t size) {
+    if (size < arena->chunk_size)
+        size = arena->chunk_size;
+    ArenaChunk *chunk = malloc(offsetof(ArenaChunk, align) + size);
+    if (!chunk)
+        return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    if (!arena->first) {
+        arena->first = chunk;
+    } else {
+        ArenaChunk *last = arena->current ? arena->current : arena->first;
+        while (last->next)
+            last = last->next;
+        last->next = chunk;
+    }
+    arena->stats.chunks++;
+    return chunk;
+}
+
+int arena_init(Arena *arena, size_t chunk_size) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+    arena->live = 0;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+    arena->stats.allocations = 0;
+    arena->stats.bytes = 0;
+    arena->stats.chunks = 0;
+    arena->stats.releases = 0;
+    arena->stats.high_water = 0;
+    return add_chunk(arena, arena->chunk_size) ? 0 : -1;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size == 0)
+        size = ARENA_ALIGN;
+    if (!arena->current) {
+        arena->current = arena->first;
+        arena->used = 0;
+    }
+    // Chunks after current are empty: they were kept by arena_release().
+    while (arena->current && arena->used + size > arena->current->size) {
+        arena->current = arena->current->next;
+        arena->used = 0;
+    }
+    if (!arena->current) {
+        arena->current = add_chunk(arena, size);
+        if (!arena->current)
+            return NULL;
+        arena->used = 0;
+    }
+    void *p = chunk_data(arena->current) + arena->used;
+    arena->used += size;
+    arena->live += size;
+    arena->stats.allocations++;
+    arena->stats.bytes += size;
+    if (arena->live > arena->stats.high_water)
+        arena->stats.high_water = arena->live;
+    return p;
+}
+
+ArenaMark arena_mark(const Arena *arena) {
+    ArenaMark mark = { arena->current, arena->used, arena->live };
+    return mark;
+}
+
+void arena_release(Arena *arena, ArenaMark mark) {
+    arena->current = mark.chunk;
+    arena->used = mark.used;
+    arena->live = mark.live;
+    arena->stats.releases++;
+}
+
+void arena_destroy(Arena *arena) {
+    ArenaChunk *chunk = arena->first;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+    arena->live = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for data that lives no longer than the VM running it:
+// the operand stacks of the VM and its call frames. Memory
+// comes from a list of chunks. arena_release() rewinds to a mark and keeps
+// the chunks for reuse, so once a program has run through its deepest
+// point, further execution makes no heap allocations at all.
+#define ARENA_DEFAULT_CHUNK 16384
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+    unsigned long allocations; // arena_alloc() calls.
+    unsigned long bytes;       // Bytes handed out, after alignment.
+    unsigned long chunks;      // Chunks taken from the heap: the arena's only mallocs.
+    unsigned long releases;    // arena_release() calls.
+    size_t high_water;         // Most bytes in use at once.
+} ArenaStats;
+
+typedef struct {
+    ArenaChunk *first;   // Oldest chunk; the list is kept in allocation order.
+    ArenaChunk *current; // Chunk being bumped, or NULL before the first allocation.
+    size_t used;         // Bytes used in current.
+    size_t live;         // Bytes handed out since the arena was last empty.
+    size_t chunk_size;
+    ArenaStats stats;
+} Arena;
+
+// Position to rewind to; taken with arena_mark().
+typedef struct {
+    ArenaChunk *chunk;
+    size_t used;
+    size_t live;
+} ArenaMark;
+
+// Sets up an arena and takes its first chunk, so a VM that fits in one
+// chunk allocates only when it is created. Returns 0, or -1 if out of memory.
+int arena_init(Arena *arena, size_t chunk_size);
+// `size` bytes aligned for any scalar, or NULL if out of memory.
+void *arena_alloc(Arena *arena, size_t size);
+ArenaMark arena_mark(const Arena *arena);
+// Frees everything allocated after `mark` was taken.
+void arena_release(Arena *arena, ArenaMark mark);
+// Gives every chunk back to the heap.
+void arena_destroy(Arena *arena);
+
+#endif // ARENA_H
@@ -1,36 +1,69 @@
 #include "bytecode.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-Bytecode* load_bytecode(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open bytecode file");
-        return NULL;
+static Bytecode *load_failed(LoadError *error, LoadFailure kind,
+                             const char *why, int os_error) {
+    if (error) {
+        error->kind = kind;
+        error->reason = why;
+        error->os_error = os_error;
     }
+    return NULL;
+}
+
+Bytecode* load_bytecode(const char *filename, int check_magic, LoadError *error) {
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return load_failed(error, LOAD_FAILED_OPEN, "cannot open file", errno);
     // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        file_size = ftell(file);
+    if (file_size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        int os_error = errno;
+        fclose(file);
+        return load_failed(error, LOAD_FAILED_READ, "cannot read bytecode", os_error);
+    }
     if(file_size < 4) {
-        fprintf(stderr, "Bytecode file too short\n");
         fclose(file);
-        return NULL;
+        if (check_magic)
+            return load_failed(error, LOAD_FAILED_MAGIC, "missing magic number", 0);
+        return load_failed(error, LOAD_FAILED_READ, "file too short", 0);
+    }
+    // The 4-byte magic header
+    uint8_t magic[4];
+    if (fread(magic, 1, 4, file) != 4) {
+        int os_error = ferror(file) ? errno : 0;
+        fclose(file);
+        return load_failed(error, LOAD_FAILED_READ, "cannot read bytecode", os_error);
+    }
+    if (check_magic &&
+        ((uint32_t)magic[0] << 24 | (uint32_t)magic[1] << 16 |
+         (uint32_t)magic[2] << 8 | magic[3]) != MAGIC_NUMBER) {
+        fclose(file);
+        return load_failed(error, LOAD_FAILED_MAGIC, "incorrect magic number", 0);
     }
-    // Skip the 4-byte magic header
-    fseek(file, 4, SEEK_SET);
     size_t instructions_length = file_size - 4;
     Bytecode *bytecode = malloc(sizeof(Bytecode));
-    if (!bytecode) exit(EXIT_FAILURE);
-    bytecode->instructions = malloc(instructions_length);
-    if (!bytecode->instructions) { free(bytecode); exit(EXIT_FAILURE); }
+    if (!bytecode) {
+        fclose(file);
+        return load_failed(error, LOAD_FAILED_READ, "out of memory", ENOMEM);
+    }
+    bytecode->instructions = malloc(instructions_length ? instructions_length : 1);
+    if (!bytecode->instructions) {
+        free(bytecode);
+        fclose(file);
+        return load_failed(error, LOAD_FAILED_READ, "out of memory", ENOMEM);
+    }
     if(fread(bytecode->instructions, 1, instructions_length, file) != instructions_length) {
-        fprintf(stderr, "Error reading bytecode instructions\n");
+        int os_error = ferror(file) ? errno : 0;
         free(bytecode->instructions);
         free(bytecode);
         fclose(file);
-        return NULL;
+        return load_failed(error, LOAD_FAILED_READ, "cannot read bytecode", os_error);
     }
     bytecode->length = instructions_length;
     fclose(file);
@@ -44,4 +77,17 @@ void free_bytecode(Bytecode *bytecode) {
     }
 }
 
+const char *opcode_name(uint8_t opcode) {
+    switch (opcode) {
+        case OP_IMPORT:      return "IMPORT";
+        case OP_CALL:        return "CALL";
+        case OP_SYSCALL:     return "SYSCALL";
+        case OP_LOAD_STRING: return "LOAD_STRING";
+        case OP_PRINT:       return "PRINT";
+        case OP_PRINTNL:     return "PRINTNL";
+        case OP_HALT:        return "HALT";
+        default:             return "UNKNOWN";
+    }
+}
+
 // Additional functions for interpreting bytecode can be added here
\ No newline at end of file
@@ -6,13 +6,42 @@
 
 #define MAGIC_NUMBER 0xFAACBEED
 
+// Opcodes
+#define OP_IMPORT        0x02
+#define OP_CALL          0x03
+#define OP_SYSCALL       0x20
+#define OP_LOAD_STRING   0x40
+#define OP_PRINT         0x50  // call built-in print (no newline)
+#define OP_PRINTNL       0x51  // call built-in printnl (with newline)
+#define OP_HALT          0xFF
+
 // Bytecode now holds the raw instruction bytes (after the 4-byte magic header)
 typedef struct Bytecode {
     uint8_t *instructions; // Instruction stream (opcodes and data)
     size_t length;         // Number of bytes in the instruction stream
 } Bytecode;
 
-Bytecode* load_bytecode(const char *filename);
+// Why load_bytecode() returned NULL.
+typedef enum {
+    LOAD_FAILED_OPEN,  // The file could not be opened.
+    LOAD_FAILED_MAGIC, // Shorter than, or not starting with, MAGIC_NUMBER.
+    LOAD_FAILED_READ,  // The file could not be read, or out of memory.
+} LoadFailure;
+
+typedef struct {
+    LoadFailure kind;
+    const char *reason; // Static text such as "file too short".
+    int os_error;       // errno behind the failure (ENOMEM if out of memory), or 0.
+} LoadError;
+
+// Reads the instructions that follow the 4-byte magic number of `filename`,
+// opening it once. With `check_magic` set, a file that does not start with
+// MAGIC_NUMBER fails with LOAD_FAILED_MAGIC. Nothing is printed: on failure
+// it returns NULL and fills in `error` if it is not NULL.
+Bytecode* load_bytecode(const char *filename, int check_magic, LoadError *error);
 void free_bytecode(Bytecode *bytecode);
 
+// Mnemonic for an opcode, or "UNKNOWN".
+const char *opcode_name(uint8_t opcode);
+
 #endif // BYTECODE_H
\ No newline at end of file
@@ -1,53 +1,140 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "bytecode.h"
+#include "modules.h"
 #include "runtime.h"
+#include "trace.h"
 
-void run_vm(const char *filename, int debug) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open bytecode file");
-        exit(EXIT_FAILURE);
-    }
-    uint8_t magic_bytes[4];
-    if (fread(magic_bytes, 1, 4, file) != 4) {
-        fprintf(stderr, "Failed to read magic number from file\n");
-        fclose(file);
-        exit(EXIT_FAILURE);
-    }
-    if (magic_bytes[0] != 0xFA || magic_bytes[1] != 0xAC ||
-        magic_bytes[2] != 0xBE || magic_bytes[3] != 0xED) {
-        fprintf(stderr, "Invalid bytecode file: incorrect magic number\n");
-        fclose(file);
-        exit(EXIT_FAILURE);
-    }
-    fclose(file);
+// Tracing settings from the command line.
+typedef struct {
+    int enabled;        // --trace: record into the ring, dump on error or SIGUSR1.
+    int dump_at_exit;   // --trace-dump: also dump when the run finishes.
+    int print_at_exit;  // --debug: print the ring as text to stderr at exit.
+    size_t capacity;    // --trace=N records.
+    const char *path;   // --trace-file=PATH
+} TraceOptions;
+
+// --alloc-stats: arena and module counters on stderr after the run. A
+// chunk count of one means the program ran without touching the heap once
+// the VM existed, and each module is read from disk once however often it
+// is called.
+static int alloc_stats = 0;
 
-    Bytecode* bytecode = load_bytecode(filename);
-    if (!bytecode) {
-        fprintf(stderr, "Failed to load bytecode from %s\n", filename);
-        exit(EXIT_FAILURE);
+static void print_alloc_stats(const Arena *arena, const ModuleTable *modules) {
+    const ArenaStats *st = &arena->stats;
+    fprintf(stderr, "covim: arena: %lu allocations, %lu bytes, high water %lu bytes, "
+            "%lu chunk(s) of %lu bytes, %lu releases\n",
+            st->allocations, st->bytes, (unsigned long)st->high_water,
+            st->chunks, (unsigned long)arena->chunk_size, st->releases);
+    fprintf(stderr, "covim: modules: %lu loaded from disk, %lu symbols\n", modules->loads,
+            (unsigned long)modules->symbol_count);
+}
+
+// Explains a failed load or run on stderr.
+static void report_failure(const char *filename, const VMResult *result, const TraceRing *trace) {
+    switch (result->status) {
+        case VM_ERR_OPEN:
+            fprintf(stderr, "Failed to open bytecode file: %s\n", strerror(result->os_error));
+            return;
+        case VM_ERR_BAD_MAGIC:
+            fprintf(stderr, "Invalid bytecode file: %s\n", result->reason);
+            return;
+        case VM_ERR_LOAD:
+            if (result->os_error)
+                fprintf(stderr, "Failed to load bytecode from %s: %s: %s\n", filename,
+                        result->reason, strerror(result->os_error));
+            else
+                fprintf(stderr, "Failed to load bytecode from %s: %s\n", filename, result->reason);
+            return;
+        case VM_ERR_MODULE_NOT_FOUND:
+            if (result->os_error)
+                fprintf(stderr, "Failed to open bytecode file: %s\n", strerror(result->os_error));
+            fprintf(stderr, "Failed to load function module: %s\n", result->name);
+            break;
+        default:
+            break;
     }
+    if (result->trace_written > 0)
+        fprintf(stderr, "covim: %s; trace written to %s\n", result->reason, trace->dump_path);
+    else if (result->trace_written < 0)
+        fprintf(stderr, "covim: %s; could not write trace to %s\n", result->reason, trace->dump_path);
+    else if (result->status != VM_ERR_MODULE_NOT_FOUND)
+        fprintf(stderr, "covim: %s at offset %u%s%s\n", result->reason, (unsigned)result->pc,
+                result->module ? " of " : "", result->module ? result->module : "");
+}
+
+// Loads and runs one program; returns the exit status for it.
+int run_vm(const char *filename, const TraceOptions *opts) {
     VM *vm = create_vm();
     if (!vm) {
         fprintf(stderr, "Failed to create VM\n");
-        exit(EXIT_FAILURE);
+        return EXIT_FAILURE;
+    }
+    if (vm_load_file(vm, filename) != VM_OK) {
+        report_failure(filename, vm_result(vm), NULL);
+        free_vm(vm);
+        return EXIT_FAILURE;
+    }
+    TraceRing *trace = NULL;
+    if (opts->enabled) {
+        trace = trace_create(opts->capacity, opts->path);
+        if (!trace) {
+            fprintf(stderr, "Failed to allocate trace buffer\n");
+            free_vm(vm);
+            return EXIT_FAILURE;
+        }
+        trace_install_signal_handler();
+        vm->trace = trace;
+    }
+    VMStatus status = vm_run(vm);
+    if (status != VM_OK)
+        report_failure(filename, vm_result(vm), trace);
+    if (trace) {
+        // A failed run has already dumped the ring.
+        if (opts->dump_at_exit && status == VM_OK && trace_dump_file(trace, trace->dump_path) != 0)
+            fprintf(stderr, "Failed to write trace to %s\n", trace->dump_path);
+        if (opts->print_at_exit)
+            trace_print(stderr, trace);
+        trace_free(trace);
     }
-    execute(vm, bytecode, debug);
+    if (alloc_stats)
+        print_alloc_stats(vm->arena, vm->modules);
     free_vm(vm);
-    free_bytecode(bytecode);
+    return status == VM_OK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <bytecode file> [--debug]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <bytecode file> [--debug] [--trace[=N]] [--trace-file=PATH] [--trace-dump] [--alloc-stats]\n", argv[0]);
         return EXIT_FAILURE;
     }
-    int debug = 0;
-    if (argc >= 3 && strcmp(argv[2], "--debug") == 0) {
-        debug = 1;
+    TraceOptions opts = { 0, 0, 0, TRACE_DEFAULT_CAPACITY, TRACE_DEFAULT_PATH };
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--debug") == 0) {
+            opts.enabled = 1;
+            opts.print_at_exit = 1;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            opts.enabled = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            long n = atol(argv[i] + 8);
+            if (n <= 0) {
+                fprintf(stderr, "Invalid trace size: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            opts.enabled = 1;
+            opts.capacity = (size_t)n;
+        } else if (strncmp(argv[i], "--trace-file=", 13) == 0) {
+            opts.enabled = 1;
+            opts.path = argv[i] + 13;
+        } else if (strcmp(argv[i], "--trace-dump") == 0) {
+            opts.enabled = 1;
+            opts.dump_at_exit = 1;
+        } else if (strcmp(argv[i], "--alloc-stats") == 0) {
+            alloc_stats = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
     }
-    run_vm(argv[1], debug);
-    return EXIT_SUCCESS;
+    return run_vm(argv[1], &opts);
 }
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+// Decodes a covim trace dump (covim --trace) into one line per instruction.
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace file> [--last=N]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t last = 0;
+    if (argc >= 3 && strncmp(argv[2], "--last=", 7) == 0)
+        last = (size_t)atol(argv[2] + 7);
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror("Failed to open trace file");
+        return EXIT_FAILURE;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TRACE_FILE_MAGIC, 4) != 0 ||
+        header.version != TRACE_FILE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s is not a trace dump from this covim build\n", argv[1]);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+
+    size_t count = (size_t)header.count;
+    size_t skip = last > 0 && last < count ? count - last : 0;
+    TraceRecord *records = malloc((count - skip) * sizeof(TraceRecord) + 1);
+    if (!records ||
+        fseek(f, (long)(skip * sizeof(TraceRecord)), SEEK_CUR) != 0 ||
+        fread(records, sizeof(TraceRecord), count - skip, f) != count - skip) {
+        fprintf(stderr, "Truncated trace file %s\n", argv[1]);
+        free(records);
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+    fclose(f);
+
+    printf("[trace] %llu instructions executed, %zu recorded, ring of %u, clock %s\n",
+           (unsigned long long)header.total, count, (unsigned)header.capacity,
+           header.clock == TRACE_CLOCK_TSC ? "tsc" : "ns");
+    trace_print_records(stdout, records, count - skip, header.total - count + skip, header.clock);
+    free(records);
+    return EXIT_SUCCESS;
+}
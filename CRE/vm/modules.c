@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "modules.h"
+
+ModuleTable *module_table_create(void) {
+    ModuleTable *table = calloc(1, sizeof(ModuleTable));
+    return table;
+}
+
+Module *module_create(Bytecode *code, int owned) {
+    Module *module = calloc(1, sizeof(Module));
+    if (module) {
+        module->code = code;
+        module->owned = owned;
+    }
+    return module;
+}
+
+void module_free(Module *module) {
+    if (!module)
+        return;
+    if (module->owned)
+        free_bytecode(module->code);
+    free(module->symbols);
+    free(module->path);
+    free(module);
+}
+
+void module_table_free(ModuleTable *table) {
+    if (!table)
+        return;
+    for (size_t i = 0; i < table->count; i++)
+        module_free(table->modules[i]);
+    for (size_t i = 0; i < table->symbol_count; i++)
+        free(table->symbols[i].name);
+    free(table->symbols);
+    free(table->modules);
+    free(table);
+}
+
+// Adds a module for `path`, without code yet; NULL if out of memory.
+static Module *new_module(ModuleTable *table, const char *path) {
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 8;
+        Module **modules = realloc(table->modules, capacity * sizeof(Module *));
+        if (!modules) return NULL;
+        table->modules = modules;
+        table->capacity = capacity;
+    }
+    Module *module = module_create(NULL, 1);
+    if (!module) return NULL;
+    module->path = malloc(strlen(path) + 1);
+    if (!module->path) {
+        free(module);
+        return NULL;
+    }
+    strcpy(module->path, path);
+    table->modules[table->count++] = module;
+    return module;
+}
+
+// The module at `path`, read on first use. A file that cannot be opened
+// gives a module without code, so a missing file is looked for only once.
+// NULL if out of memory.
+static Module *load_module(ModuleTable *table, const char *path) {
+    for (size_t i = 0; i < table->count; i++) {
+        if (strcmp(table->modules[i]->path, path) == 0)
+            return table->modules[i];
+    }
+    Module *module = new_module(table, path);
+    if (!module) return NULL;
+    LoadError error;
+    module->code = load_bytecode(path, 0, &error);
+    if (!module->code)
+        module->open_error = error.os_error;
+    if (module->code)
+        table->loads++;
+    return module;
+}
+
+// CALLs of these run the current import instead of a module.
+static const char *const builtins[] = { "printnl", "srsl" };
+
+static int is_builtin(const uint8_t *name, size_t len) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strlen(builtins[i]) == len && memcmp(builtins[i], name, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Sets `index` to the symbol for `name` used by an IMPORT (`import` set)
+// or a CALL, added with its module loaded on first sight. Returns 0, or -1
+// if out of memory.
+static int intern(ModuleTable *table, int import, const uint8_t *name, size_t len, uint32_t *index) {
+    SymbolKind kind = import ? SYM_IMPORT : is_builtin(name, len) ? SYM_BUILTIN : SYM_FUNCTION;
+    for (size_t i = 0; i < table->symbol_count; i++) {
+        Symbol *sym = &table->symbols[i];
+        if (sym->kind == kind && sym->length == len && memcmp(sym->name, name, len) == 0) {
+            *index = (uint32_t)i;
+            return 0;
+        }
+    }
+    if (table->symbol_count == table->symbol_capacity) {
+        size_t capacity = table->symbol_capacity ? table->symbol_capacity * 2 : 16;
+        Symbol *symbols = realloc(table->symbols, capacity * sizeof(Symbol));
+        if (!symbols) return -1;
+        table->symbols = symbols;
+        table->symbol_capacity = capacity;
+    }
+    Symbol sym;
+    sym.kind = kind;
+    sym.length = len;
+    sym.name = malloc(len + 1);
+    if (!sym.name) return -1;
+    memcpy(sym.name, name, len);
+    sym.name[len] = '\0';
+    sym.module = NULL;
+    char path[256];
+    if (kind == SYM_IMPORT) {
+        // For example, assume modules are in "/workspaces/CVM-CRE-DEFCAA/Covi1/test/"
+        snprintf(path, sizeof(path), "/workspaces/CVM-CRE-DEFCAA/Covi1/test/%s", sym.name);
+        sym.module = load_module(table, path);
+    } else if (kind == SYM_FUNCTION) {
+        // For example, assume function modules are stored in "/workspaces/CVM-CRE-DEFCAA/Covi1/colib/"
+        snprintf(path, sizeof(path), "/workspaces/CVM-CRE-DEFCAA/Covi1/colib/%s.col", sym.name);
+        sym.module = load_module(table, path);
+    }
+    if (kind != SYM_BUILTIN && !sym.module) {
+        free(sym.name);
+        return -1;
+    }
+    table->symbols[table->symbol_count] = sym;
+    *index = (uint32_t)table->symbol_count++;
+    return 0;
+}
+// Walks the instructions the way execute() decodes them. The walk stops
+// where execution would: at HALT, an unknown opcode or a truncated operand.
+static int link_code(ModuleTable *table, Module *module, const uint8_t *code, size_t length) {
+    size_t pc = 0;
+    while (pc < length) {
+        size_t at = pc;
+        uint8_t opcode = code[pc++];
+        switch (opcode) {
+            case OP_LOAD_STRING:
+            case OP_IMPORT:
+            case OP_CALL: {
+                if (pc >= length) return 0;
+                uint8_t len = code[pc++];
+                if (pc + len > length) return 0;
+                if (opcode != OP_LOAD_STRING) {
+                    uint32_t index;
+                    if (intern(table, opcode == OP_IMPORT, &code[pc], len, &index) != 0)
+                        return -1;
+                    module->symbols[at] = index;
+                    if (table->symbols[index].module && module_link(table, table->symbols[index].module) != 0)
+                        return -1;
+                }
+                pc += len;
+                break;
+            }
+            case OP_SYSCALL: {
+                if (pc >= length) return 0;
+                uint8_t sys_id = code[pc++];
+                if (sys_id == 0x30) {
+                    if (pc >= length) return 0;
+                    uint8_t str_len = code[pc++];
+                    pc += str_len + 4;
+                } else if (sys_id != 0x31) {
+                    return 0;
+                }
+                break;
+            }
+            case OP_PRINT:
+            case OP_PRINTNL:
+                break;
+            default: // OP_HALT or an unknown opcode.
+                return 0;
+        }
+    }
+    return 0;
+}
+
+int module_link(ModuleTable *table, Module *module) {
+    if (module->linked || !module->code)
+        return 0;
+    size_t length = module->code->length;
+    const uint8_t *code = module->code->instructions;
+    module->symbols = calloc(length ? length : 1, sizeof(uint32_t));
+    if (!module->symbols) return -1;
+    module->linked = 1;
+    if (link_code(table, module, code, length) != 0) {
+        // Linked again from scratch if it is ever reached another time.
+        free(module->symbols);
+        module->symbols = NULL;
+        module->linked = 0;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include <stddef.h>
+#include "bytecode.h"
+
+// Every module a run touches, each read from disk at most once, and every
+// name an IMPORT or CALL refers to. Linking a module interns each of those
+// names as a Symbol and records its index by opcode offset. At run time the
+// opcodes dispatch on the symbol's kind, with no name comparison, path
+// building or file access, whatever the length of the name.
+typedef struct Module Module;
+struct Module {
+    char *path;
+    Bytecode *code;     // NULL if the file could not be read.
+    int open_error;     // errno behind the failed load when code is NULL, or 0.
+    int owned;          // code is freed with the table.
+    int linked;
+    uint32_t *symbols;  // Per opcode offset: symbol of the IMPORT or CALL there.
+};
+
+typedef enum {
+    SYM_IMPORT,    // IMPORT: makes module the current import.
+    SYM_BUILTIN,   // CALL of printnl or srsl: runs the current import.
+    SYM_FUNCTION,  // Any other CALL: runs module.
+    SYM_KINDS
+} SymbolKind;
+
+typedef struct {
+    SymbolKind kind;
+    char *name;
+    size_t length;
+    Module *module;  // NULL for builtins.
+} Symbol;
+
+typedef struct ModuleTable {
+    Module **modules;
+    size_t count;
+    size_t capacity;
+    Symbol *symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+    Module *current_import;  // Set by each IMPORT as it runs.
+    unsigned long loads;     // Modules read from disk.
+} ModuleTable;
+
+ModuleTable *module_table_create(void);
+void module_table_free(ModuleTable *table);
+
+// A module outside the table, such as the main program; `owned` makes
+// module_free() free the code too. NULL if out of memory.
+Module *module_create(Bytecode *code, int owned);
+void module_free(Module *module);
+
+// Interns the IMPORT and CALL names of `module` and of every module it
+// reaches, loading each module the first time it is named. Returns 0, or
+// -1 if out of memory.
+int module_link(ModuleTable *table, Module *module);
+
+#endif // MODULES_H
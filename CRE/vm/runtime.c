@@ -1,228 +1,350 @@
+#include <errno.h>
 #include <stdio.h>   // Added: required for FILE, snprintf, fopen, fclose, printf, fwrite, stdout
 #include <stdlib.h>
 #include <string.h>
 #include "runtime.h"
 #include "bytecode.h"
-#include <unistd.h> // for write()
+#include "modules.h"
+#include "strref.h"
+#include "trace.h"
 
 // Extern declarations for built-in printing functions defined in cblio.c
-extern void print(const char *text);
-extern void printnl(const char *text);
-
-// Updated opcode definitions for built-in calls:
-#define OP_PRINT         0x50  // new: call built-in print (no newline)
-#define OP_PRINTNL       0x51  // new: call built-in printnl (with newline)
-#define OP_IMPORT        0x02
-#define OP_CALL          0x03
-#define OP_SYSCALL       0x20  // New syscall opcode
-#define OP_HALT          0xFF
-#define OP_LOAD_STRING   0x40  // new
-
-// Global variable to hold imported module bytecode (for simple simulation)
-static Bytecode *imported_module = NULL;
-
-// Updated import_module: load module file from a fixed directory silently.
-static void import_module(const char *module) {
-    // Construct full module file path.
-    char filepath[256];
-    // For example, assume modules are in "/workspaces/CVM-CRE-DEFCAA/Covi1/test/"
-    snprintf(filepath, sizeof(filepath), "/workspaces/CVM-CRE-DEFCAA/Covi1/test/%s", module);
-    
-    // Try to open the file without printing error.
-    FILE *f = fopen(filepath, "rb");
-    if (!f) {
-        // Simulate an empty module if file not found.
-        Bytecode *mod = malloc(sizeof(Bytecode));
-        if (!mod) exit(EXIT_FAILURE);
-        mod->instructions = NULL;
-        mod->length = 0;
-        imported_module = mod;
-        return;
-    }
-    fclose(f);
-    // File exists, load its bytecode.
-    Bytecode *mod = load_bytecode(filepath);
-    if (!mod) {
-        // Should not happen, but simulate empty module.
-        mod = malloc(sizeof(Bytecode));
-        if (!mod) exit(EXIT_FAILURE);
-        mod->instructions = NULL;
-        mod->length = 0;
-    }
-    imported_module = mod;
+extern void print_len(const char *text, size_t len);
+extern void printnl_len(const char *text, size_t len);
+extern void cblio_flush(void);
+
+// Records why the run stops at the opcode at `pc` of `module` and returns
+// `status` for the caller to pass up. Buffered output is written first.
+// With tracing on, the ring is dumped too, so the instructions leading up
+// to the failure are kept.
+static VMStatus fail(VM *vm, const Module *module, int pc, VMStatus status, const char *reason) {
+    VMResult *result = vm->result;
+    result->status = status;
+    result->reason = reason;
+    result->pc = (uint32_t)pc;
+    result->call_depth = vm->call_depth;
+    result->module = module ? module->path : NULL;
+    result->name = NULL;
+    result->os_error = 0;
+    result->trace_written = 0;
+    cblio_flush();
+    if (vm->trace)
+        result->trace_written = trace_dump_file(vm->trace, vm->trace->dump_path) == 0 ? 1 : -1;
+    return status;
 }
 
-// Updated call_function: now check for "printnl" and "srsl"
-static void call_function(const char *func) {
-    // Built-in calls: printnl and srsl
-    if (strcmp(func, "printnl") == 0 || strcmp(func, "srsl") == 0) {
-        if (imported_module && imported_module->length > 0) {
-            VM *temp_vm = create_vm();
-            execute(temp_vm, imported_module, 0);
-            free_vm(temp_vm);
-        }
-    } else {
-        // For other functions, try to load the function module from a fixed directory.
-        char path[256];
-        // For example, assume function modules are stored in "/workspaces/CVM-CRE-DEFCAA/Covi1/colib/"
-        snprintf(path, sizeof(path), "/workspaces/CVM-CRE-DEFCAA/Covi1/colib/%s.col", func);
-        Bytecode *module = load_bytecode(path);
-        if (module && module->length > 0) {
-            VM *temp_vm = create_vm();
-            execute(temp_vm, module, 0);
-            free_vm(temp_vm);
-        } else {
-            fprintf(stderr, "Failed to load function module: %s\n", func);
-            exit(EXIT_FAILURE);
-        }
-        if (module) free_bytecode(module);
-    }
+// Records a failure that happened outside any module: loading, or a run
+// without a program.
+static VMStatus fail_load(VM *vm, VMStatus status, const char *reason, int os_error) {
+    VMResult *result = vm->result;
+    memset(result, 0, sizeof(*result));
+    result->status = status;
+    result->reason = reason;
+    result->os_error = os_error;
+    return status;
 }
 
+static VMStatus run_module(VM *vm, Module *module);
+
+// Runs `module` in a frame borrowing the caller's arena, module table and
+// result; everything the call allocated is released when it returns.
+static VMStatus run_frame(VM *vm, const Module *caller, int at, Module *module) {
+    if (vm->call_depth + 1 > MAX_CALL_DEPTH)
+        return fail(vm, caller, at, VM_ERR_CALL_DEPTH, "call depth exceeded");
+    ArenaMark mark = arena_mark(vm->arena);
+    VM frame;
+    frame.stack = arena_alloc(vm->arena, STACK_SIZE * sizeof(uintptr_t));
+    if (!frame.stack)
+        return fail(vm, caller, at, VM_ERR_OUT_OF_MEMORY, "out of memory");
+    frame.stack_pointer = 0;
+    frame.trace = vm->trace;
+    frame.call_depth = vm->call_depth + 1;
+    frame.arena = vm->arena;
+    frame.base = arena_mark(vm->arena);
+    frame.modules = vm->modules;
+    frame.result = vm->result;
+    frame.program = NULL;
+    VMStatus status = run_module(&frame, module);
+    arena_release(vm->arena, mark);
+    return status;
+}
+
+// Everything a run needs comes from here: the VM, its arena, and the
+// arena's first chunk, which also holds the stack.
 VM* create_vm(void) {
-    VM* vm = malloc(sizeof(VM));
-    if (!vm) exit(EXIT_FAILURE);
-    vm->stack = malloc(STACK_SIZE * sizeof(uintptr_t)); // use uintptr_t size
-    if (!vm->stack) { free(vm); exit(EXIT_FAILURE); }
+    VM* vm = calloc(1, sizeof(VM));
+    if (!vm) return NULL;
+    vm->arena = malloc(sizeof(Arena));
+    if (!vm->arena || arena_init(vm->arena, ARENA_DEFAULT_CHUNK) != 0) {
+        free(vm->arena);
+        free(vm);
+        return NULL;
+    }
+    vm->stack = arena_alloc(vm->arena, STACK_SIZE * sizeof(uintptr_t)); // use uintptr_t size
+    vm->modules = module_table_create();
+    if (!vm->stack || !vm->modules) {
+        arena_destroy(vm->arena);
+        free(vm->arena);
+        free(vm);
+        return NULL;
+    }
     vm->stack_pointer = 0;
+    vm->trace = NULL;
+    vm->call_depth = 0;
+    vm->base = arena_mark(vm->arena);
+    vm->result = &vm->own_result;
+    vm->program = NULL;
+    fail_load(vm, VM_OK, "ok", 0);
     return vm;
 }
 
-void push(VM* vm, uintptr_t value) {
-    if (vm->stack_pointer >= STACK_SIZE) {
-        exit(EXIT_FAILURE);
-    }
+VMStatus push(VM* vm, uintptr_t value) {
+    if (vm->stack_pointer >= STACK_SIZE)
+        return VM_ERR_STACK_OVERFLOW;
     vm->stack[vm->stack_pointer++] = value;
+    return VM_OK;
+}
+
+VMStatus pop(VM* vm, uintptr_t *value) {
+    if (vm->stack_pointer <= 0)
+        return VM_ERR_STACK_UNDERFLOW;
+    *value = vm->stack[--vm->stack_pointer];
+    return VM_OK;
+}
+
+// Pops a string and writes it out. Literals used to be copied into C
+// strings, so output still stops at a NUL byte.
+static VMStatus print_string(VM *vm, const Bytecode *bytecode, int newline) {
+    uintptr_t ref;
+    if (pop(vm, &ref) != VM_OK)
+        return VM_ERR_STACK_UNDERFLOW;
+    const char *text = str_data(ref, bytecode->instructions);
+    size_t len = str_length(ref);
+    const char *nul = memchr(text, '\0', len);
+    if (nul)
+        len = (size_t)(nul - text);
+    if (newline)
+        printnl_len(text, len);
+    else
+        print_len(text, len);
+    return VM_OK;
+}
+
+// Loaded at link time; a missing file imports an empty module.
+static VMStatus import_symbol(VM *vm, const Module *caller, int at, const Symbol *sym) {
+    (void)caller;
+    (void)at;
+    vm->modules->current_import = sym->module;
+    return VM_OK;
 }
 
-uintptr_t pop(VM* vm) {
-    if (vm->stack_pointer <= 0) {
-        exit(EXIT_FAILURE);
+// Built-in calls: printnl and srsl run the last import.
+static VMStatus call_builtin(VM *vm, const Module *caller, int at, const Symbol *sym) {
+    (void)sym;
+    Module *import = vm->modules->current_import;
+    if (import && import->code && import->code->length > 0)
+        return run_frame(vm, caller, at, import);
+    return VM_OK;
+}
+
+static VMStatus call_function(VM *vm, const Module *caller, int at, const Symbol *sym) {
+    Module *target = sym->module;
+    if (target->code && target->code->length > 0)
+        return run_frame(vm, caller, at, target);
+    fail(vm, caller, at, VM_ERR_MODULE_NOT_FOUND, "function module not found");
+    vm->result->name = sym->name;
+    vm->result->os_error = target->code ? 0 : target->open_error;
+    return VM_ERR_MODULE_NOT_FOUND;
+}
+
+// What IMPORT and CALL do, by the kind of symbol they name.
+static VMStatus (*const symbol_handlers[SYM_KINDS])(VM *, const Module *, int, const Symbol *) = {
+    import_symbol, // SYM_IMPORT
+    call_builtin,  // SYM_BUILTIN
+    call_function  // SYM_FUNCTION
+};
+
+// Clears what a previous run left: stack, current import and result.
+static void begin_run(VM *vm) {
+    vm->stack_pointer = 0;
+    arena_release(vm->arena, vm->base);
+    vm->modules->current_import = NULL;
+    fail_load(vm, VM_OK, "ok", 0);
+}
+
+// Links `code` as the loaded program, replacing the previous one.
+static VMStatus install_program(VM *vm, Bytecode *code) {
+    module_free(vm->program);
+    vm->program = module_create(code, 1);
+    if (!vm->program) {
+        free_bytecode(code);
+        return fail_load(vm, VM_ERR_OUT_OF_MEMORY, "out of memory", 0);
     }
-    return vm->stack[--vm->stack_pointer];
+    if (module_link(vm->modules, vm->program) != 0) {
+        module_free(vm->program);
+        vm->program = NULL;
+        return fail_load(vm, VM_ERR_OUT_OF_MEMORY, "out of memory", 0);
+    }
+    return fail_load(vm, VM_OK, "ok", 0);
 }
 
-static void push_ptr(VM* vm, void *ptr) {
-    // Push pointer value into vm->stack (cast to uint32_t).
-    push(vm, (uintptr_t)ptr);
+VMStatus vm_load_file(VM *vm, const char *filename) {
+    module_free(vm->program);
+    vm->program = NULL;
+    LoadError error;
+    Bytecode *bytecode = load_bytecode(filename, 1, &error);
+    if (!bytecode) {
+        VMStatus status = VM_ERR_LOAD;
+        if (error.kind == LOAD_FAILED_OPEN)
+            status = VM_ERR_OPEN;
+        else if (error.kind == LOAD_FAILED_MAGIC)
+            status = VM_ERR_BAD_MAGIC;
+        else if (error.os_error == ENOMEM)
+            status = VM_ERR_OUT_OF_MEMORY;
+        return fail_load(vm, status, error.reason, error.os_error);
+    }
+    return install_program(vm, bytecode);
+}
+
+VMStatus vm_load_bytes(VM *vm, const uint8_t *data, size_t length) {
+    module_free(vm->program);
+    vm->program = NULL;
+    if (length < 4)
+        return fail_load(vm, VM_ERR_BAD_MAGIC, "missing magic number", 0);
+    if (data[0] != 0xFA || data[1] != 0xAC || data[2] != 0xBE || data[3] != 0xED)
+        return fail_load(vm, VM_ERR_BAD_MAGIC, "incorrect magic number", 0);
+    Bytecode *bytecode = malloc(sizeof(Bytecode));
+    if (!bytecode)
+        return fail_load(vm, VM_ERR_OUT_OF_MEMORY, "out of memory", 0);
+    bytecode->length = length - 4;
+    bytecode->instructions = malloc(bytecode->length ? bytecode->length : 1);
+    if (!bytecode->instructions) {
+        free(bytecode);
+        return fail_load(vm, VM_ERR_OUT_OF_MEMORY, "out of memory", 0);
+    }
+    memcpy(bytecode->instructions, data + 4, bytecode->length);
+    return install_program(vm, bytecode);
 }
 
-static void *pop_ptr(VM* vm) {
-    return (void *) pop(vm);
+VMStatus vm_run(VM *vm) {
+    begin_run(vm);
+    if (!vm->program)
+        return fail_load(vm, VM_ERR_NO_PROGRAM, "no program loaded", 0);
+    VMStatus status = run_module(vm, vm->program);
+    cblio_flush();
+    return status;
 }
 
-void execute(VM* vm, Bytecode* bytecode, int debug) {
+void vm_reset(VM *vm) {
+    begin_run(vm);
+    module_free(vm->program);
+    vm->program = NULL;
+}
+
+const VMResult *vm_result(const VM *vm) {
+    return vm->result;
+}
+
+// Links the program, loading every module it imports or calls, then runs
+// it. Whatever it printed is on stdout when this returns.
+VMStatus execute(VM* vm, Bytecode* bytecode) {
+    begin_run(vm);
+    Module *program = module_create(bytecode, 0);
+    if (!program || module_link(vm->modules, program) != 0) {
+        module_free(program);
+        return fail_load(vm, VM_ERR_OUT_OF_MEMORY, "out of memory", 0);
+    }
+    VMStatus status = run_module(vm, program);
+    cblio_flush();
+    module_free(program);
+    return status;
+}
+
+static VMStatus run_module(VM *vm, Module *module) {
+    Bytecode *bytecode = module->code;
     int pc = 0;
     while (pc < (int)bytecode->length) {
+        int at = pc;
         uint8_t opcode = bytecode->instructions[pc++];
-        if (debug) {
-            printf("[DEBUG] Opcode: 0x%02X at pc=%d\n", opcode, pc - 1);
+        if (vm->trace) {
+            trace_record(vm->trace, (uint32_t)at, opcode, (uint8_t)vm->call_depth,
+                         (uint16_t)vm->stack_pointer);
+            if (trace_dump_due(vm->trace))
+                trace_dump_file(vm->trace, vm->trace->dump_path);
         }
         switch (opcode) {
             case OP_LOAD_STRING: {
-                if (pc >= (int)bytecode->length) exit(EXIT_FAILURE);
+                if (pc >= (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
                 uint8_t len = bytecode->instructions[pc++];
-                if (pc + len > (int)bytecode->length) exit(EXIT_FAILURE);
-                char *str = malloc(len + 1);
-                if (!str) exit(EXIT_FAILURE);
-                memcpy(str, &bytecode->instructions[pc], len);
-                str[len] = '\0';
-                push_ptr(vm, str);
+                if (pc + len > (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
+                if (push(vm, str_literal((size_t)pc, len)) != VM_OK)
+                    return fail(vm, module, at, VM_ERR_STACK_OVERFLOW, "stack overflow");
                 pc += len;
                 break;
             }
-            case OP_PRINT: {
-                // Pop string from stack and call built-in print() from cblio.c.
-                char *arg = pop_ptr(vm);
-                print(arg);
-                free(arg);
-                break;
-            }
-            case OP_PRINTNL: {
-                // Pop string from stack and call built-in printnl() from cblio.c.
-                char *arg = pop_ptr(vm);
-                printnl(arg);
-                free(arg);
-                break;
-            }
-            case OP_IMPORT: {
-                if (pc >= (int)bytecode->length) {
-                    exit(EXIT_FAILURE);
-                }
-                uint8_t len = bytecode->instructions[pc++];
-                if (pc + len > (int)bytecode->length) {
-                    exit(EXIT_FAILURE);
-                }
-                char *module = malloc(len + 1);
-                if (!module) exit(EXIT_FAILURE);
-                for (int i = 0; i < len; i++) {
-                    module[i] = bytecode->instructions[pc + i];
-                }
-                module[len] = '\0';
-                // Call import_module to load and link the module.
-                import_module(module);
-                free(module);
-                pc += len;
+            case OP_PRINT:
+            case OP_PRINTNL:
+                // Pop string from stack and call built-in print_len() or
+                // printnl_len() from cblio.c.
+                if (print_string(vm, bytecode, opcode == OP_PRINTNL) != VM_OK)
+                    return fail(vm, module, at, VM_ERR_STACK_UNDERFLOW, "stack underflow");
                 break;
-            }
+            case OP_IMPORT:
             case OP_CALL: {
-                if (pc >= (int)bytecode->length) exit(EXIT_FAILURE);
+                if (pc >= (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
                 uint8_t len = bytecode->instructions[pc++];
-                if (pc + len > (int)bytecode->length) exit(EXIT_FAILURE);
-                char *func = malloc(len + 1);
-                if (!func) exit(EXIT_FAILURE);
-                memcpy(func, &bytecode->instructions[pc], len);
-                func[len] = '\0';
+                if (pc + len > (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
                 pc += len;
-                // Here we call call_function() for imported module handling (unchanged)
-                call_function(func);
-                free(func);
+                const Symbol *sym = &vm->modules->symbols[module->symbols[at]];
+                VMStatus status = symbol_handlers[sym->kind](vm, module, at, sym);
+                if (status != VM_OK)
+                    return status;
                 break;
             }
             case OP_SYSCALL: {
-                if (pc >= (int)bytecode->length) exit(EXIT_FAILURE);
+                if (pc >= (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
                 uint8_t sys_id = bytecode->instructions[pc++];
                 switch (sys_id) {
                     case 0x30: { // write syscall
-                        if (pc >= (int)bytecode->length) exit(EXIT_FAILURE);
+                        if (pc >= (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
                         uint8_t str_len = bytecode->instructions[pc++];
-                        if (pc + str_len > (int)bytecode->length) exit(EXIT_FAILURE);
-                        char *buffer = malloc(str_len + 1);
-                        if (!buffer) exit(EXIT_FAILURE);
-                        memcpy(buffer, &bytecode->instructions[pc], str_len);
-                        buffer[str_len] = '\0';
+                        if (pc + str_len > (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
+                        // The operand goes out in place, without a copy.
+                        const uint8_t *buffer = &bytecode->instructions[pc];
                         pc += str_len;
-                        if (pc + 4 > (int)bytecode->length) exit(EXIT_FAILURE);
-                        int arg_int = (bytecode->instructions[pc] << 24) |
-                                      (bytecode->instructions[pc+1] << 16) |
-                                      (bytecode->instructions[pc+2] << 8) |
-                                      (bytecode->instructions[pc+3]);
+                        if (pc + 4 > (int)bytecode->length) return fail(vm, module, at, VM_ERR_TRUNCATED, "truncated operand");
+                        // The 4-byte argument that follows is not used.
                         pc += 4;
-                        // Write the string using write() syscall.
-                        write(1, buffer, str_len);
-                        free(buffer);
+                        // Write the string through cblio, after what print has buffered.
+                        print_len((const char *)buffer, str_len);
                         break;
                     }
                     case 0x31: { // nextLine syscall
-                        write(1, "\n", 1);
+                        print_len("\n", 1);
                         break;
                     }
                     default:
-                        exit(EXIT_FAILURE);
+                        return fail(vm, module, at, VM_ERR_UNKNOWN_SYSCALL, "unknown syscall");
                 }
                 break;
             }
             case OP_HALT:
-                return;
+                if (vm->call_depth == 0)
+                    cblio_flush();
+                return VM_OK;
             default:
-                exit(EXIT_FAILURE);
+                return fail(vm, module, at, VM_ERR_UNKNOWN_OPCODE, "unknown opcode");
         }
     }
+    return VM_OK;
 }
 
 void free_vm(VM* vm) {
     if (vm) {
-        free(vm->stack);
+        module_free(vm->program);
+        module_table_free(vm->modules);
+        arena_destroy(vm->arena);
+        free(vm->arena);
         free(vm);
     }
-}
\ No newline at end of file
+}
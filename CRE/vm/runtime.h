@@ -3,21 +3,105 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "arena.h"
 
 #define STACK_SIZE 256
+#define MAX_CALL_DEPTH 128
+
+typedef struct TraceRing TraceRing;
+typedef struct ModuleTable ModuleTable;
+typedef struct Module Module;
+
+// Outcome of loading or running a program. The runtime never prints or
+// exits: every failure comes back as one of these, with the details in the
+// VM's VMResult.
+typedef enum {
+    VM_OK = 0,
+    VM_ERR_STACK_OVERFLOW,
+    VM_ERR_STACK_UNDERFLOW,
+    VM_ERR_TRUNCATED,         // An operand runs past the end of its module.
+    VM_ERR_UNKNOWN_OPCODE,
+    VM_ERR_UNKNOWN_SYSCALL,
+    VM_ERR_MODULE_NOT_FOUND,  // A CALL names a module that is missing or empty.
+    VM_ERR_CALL_DEPTH,        // Calls nested deeper than MAX_CALL_DEPTH.
+    VM_ERR_OUT_OF_MEMORY,
+    VM_ERR_OPEN,              // vm_load_file(): the file could not be opened.
+    VM_ERR_BAD_MAGIC,         // The program does not start with FAACBEED.
+    VM_ERR_LOAD,              // vm_load_file(): the file could not be read.
+    VM_ERR_NO_PROGRAM         // vm_run() without a loaded program.
+} VMStatus;
 
 typedef struct {
+    VMStatus status;
+    const char *reason;   // Static text for status, e.g. "stack underflow".
+    uint32_t pc;          // Offset of the failing opcode in its module.
+    int call_depth;       // 0 if it failed in the main program.
+    const char *module;   // Path of the module it failed in; NULL for the main program.
+    const char *name;     // VM_ERR_MODULE_NOT_FOUND: the name the CALL used.
+    int os_error;         // errno behind VM_ERR_OPEN or VM_ERR_MODULE_NOT_FOUND, or 0.
+    int trace_written;    // 1 if the trace ring was dumped for the failure, -1 if
+                          // that failed, 0 without tracing.
+} VMResult;
+
+// A VM made by create_vm() owns an arena holding its operand stack, the
+// table of modules the program links against, and the loaded program. Called modules run in frames on the C stack that
+// borrow all of it and rewind the arena when they return.
+typedef struct VM {
     uintptr_t *stack;    // changed from uint32_t* to uintptr_t*
     int stack_pointer;
-    // Additional fields for execution context can be added here
+    TraceRing *trace;    // Records every instruction when set; not owned.
+    int call_depth;      // Nesting of the module being executed.
+    Arena *arena;        // Owned only by a VM from create_vm().
+    ArenaMark base;      // Arena position with this VM's stack empty.
+    ModuleTable *modules; // Owned only by a VM from create_vm().
+    VMResult *result;    // Where a failure is recorded; frames share the root's.
+    VMResult own_result;
+    Module *program;     // Set by vm_load_file() or vm_load_bytes(); NULL in frames.
 } VM;
 
 typedef struct Bytecode Bytecode; // Forward declaration
 
+// Embedding API. A worker keeps one VM and runs program after program in
+// it, with no process per program:
+//
+//     VM *vm = create_vm();
+//     while (next_program(&path)) {
+//         if (vm_load_file(vm, path) != VM_OK || vm_run(vm) != VM_OK)
+//             report(vm_result(vm));
+//         vm_reset(vm);
+//     }
+//     free_vm(vm);
+//
+// All state lives in the VM, so separate VMs can run on separate threads.
+// SIGUSR1 is the one process-wide input: it asks every traced VM to dump
+// its own ring once, each to its own dump_path.
+// Output goes through cblio, which buffers per thread and is flushed when a
+// run ends. Modules stay loaded across programs until free_vm().
+
+// NULL if out of memory.
 VM* create_vm(void);
 void free_vm(VM *vm);
-void push(VM *vm, uintptr_t value);
-uintptr_t pop(VM *vm);
-void execute(VM *vm, Bytecode *bytecode, int debug);
 
-#endif // RUNTIME_H
\ No newline at end of file
+// Loads and links a program, replacing any loaded before. vm_load_bytes()
+// copies `length` bytes, starting with the magic number.
+VMStatus vm_load_file(VM *vm, const char *filename);
+VMStatus vm_load_bytes(VM *vm, const uint8_t *data, size_t length);
+
+// Runs the loaded program from the start with an empty stack. Any number
+// of runs can follow one load.
+VMStatus vm_run(VM *vm);
+
+// Unloads the program and clears the stack and last result,
+// leaving the VM as create_vm() made it apart from the loaded modules.
+void vm_reset(VM *vm);
+
+// Details of the last failure; status is VM_OK after a successful run.
+const VMResult *vm_result(const VM *vm);
+
+// Links and runs code the caller owns, without loading it into the VM.
+VMStatus execute(VM *vm, Bytecode *bytecode);
+
+VMStatus push(VM *vm, uintptr_t value);
+VMStatus pop(VM *vm, uintptr_t *value);
+
+#endif // RUNTIME_H
@@ -0,0 +1,24 @@
+#ifndef STRREF_H
+#define STRREF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A string on the covim operand stack is one word: a view of `length`
+// bytes at `offset` in the instruction buffer of the module that pushed it.
+// LOAD_STRING copies nothing. Module code is immutable and outlives every
+// frame running it, and a frame only ever pops what it pushed itself.
+static inline uintptr_t str_literal(size_t offset, uint8_t length) {
+    return ((uintptr_t)offset << 8) | length;
+}
+
+// Bytes of `ref`; `code` is the instruction buffer of the pushing module.
+static inline const char *str_data(uintptr_t ref, const uint8_t *code) {
+    return (const char *)code + (ref >> 8);
+}
+
+static inline size_t str_length(uintptr_t ref) {
+    return ref & 0xFF;
+}
+
+#endif // STRREF_H
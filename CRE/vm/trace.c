@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "trace.h"
+
+volatile sig_atomic_t trace_dump_requests = 0;
+
+TraceRing *trace_create(size_t capacity, const char *dump_path) {
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    TraceRing *ring = malloc(sizeof(TraceRing));
+    if (!ring) return NULL;
+    ring->records = calloc(size, sizeof(TraceRecord));
+    ring->dump_path = strdup(dump_path ? dump_path : TRACE_DEFAULT_PATH);
+    if (!ring->records || !ring->dump_path) {
+        trace_free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    ring->next = 0;
+    ring->dump_seen = trace_dump_requests;
+    return ring;
+}
+
+void trace_free(TraceRing *ring) {
+    if (ring) {
+        free(ring->records);
+        free(ring->dump_path);
+        free(ring);
+    }
+}
+
+static void request_dump(int sig) {
+    (void)sig;
+    trace_dump_requests = trace_dump_requests == SIG_ATOMIC_MAX ? 1 : trace_dump_requests + 1;
+}
+
+void trace_install_signal_handler(void) {
+    signal(SIGUSR1, request_dump);
+}
+
+// The records still in the ring form at most two contiguous runs: from the
+// oldest slot to the end of the array, then from slot 0.
+static uint64_t held(const TraceRing *ring) {
+    uint64_t capacity = ring->mask + 1;
+    return ring->next < capacity ? ring->next : capacity;
+}
+
+int trace_dump_file(const TraceRing *ring, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_FILE_MAGIC, 4);
+    header.version = TRACE_FILE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.clock = trace_clock_kind();
+    header.capacity = (uint32_t)(ring->mask + 1);
+    header.total = ring->next;
+    header.count = held(ring);
+
+    uint64_t start = (ring->next - header.count) & ring->mask;
+    uint64_t first_run = header.count < ring->mask + 1 - start ? header.count : ring->mask + 1 - start;
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(ring->records + start, sizeof(TraceRecord), first_run, f) == first_run &&
+             fwrite(ring->records, sizeof(TraceRecord), header.count - first_run, f) == header.count - first_run;
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+void trace_print_records(FILE *out, const TraceRecord *records, size_t count,
+                         uint64_t first, uint32_t clock) {
+    const char *unit = clock == TRACE_CLOCK_TSC ? "cycles" : "ns";
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord *r = &records[i];
+        fprintf(out, "#%-10llu %*spc=%-6u %-12s (0x%02X) stack=%u",
+                (unsigned long long)(first + i), 2 * r->call_depth, "",
+                (unsigned)r->pc, opcode_name(r->opcode), r->opcode, (unsigned)r->stack_depth);
+        if (i > 0)
+            fprintf(out, " +%llu %s", (unsigned long long)(r->time - records[i - 1].time), unit);
+        fputc('\n', out);
+    }
+}
+
+void trace_print(FILE *out, const TraceRing *ring) {
+    uint64_t count = held(ring);
+    uint64_t first = ring->next - count;
+    // Copy out in order so the deltas line up across the wrap point.
+    TraceRecord *ordered = malloc(count * sizeof(TraceRecord) + 1);
+    if (!ordered) return;
+    for (uint64_t i = 0; i < count; i++)
+        ordered[i] = ring->records[(first + i) & ring->mask];
+    fprintf(out, "[trace] last %llu of %llu instructions\n",
+            (unsigned long long)count, (unsigned long long)ring->next);
+    trace_print_records(out, ordered, count, first, trace_clock_kind());
+    free(ordered);
+}
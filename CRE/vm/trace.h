@@ -0,0 +1,114 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// One executed instruction. Records are fixed-size and written straight into
+// the ring, so tracing costs a timestamp read and a 16-byte store.
+typedef struct {
+    uint32_t pc;          // Offset of the opcode in its module.
+    uint8_t opcode;
+    uint8_t call_depth;   // 0 for the main program, +1 per nested call.
+    uint16_t stack_depth; // Operand stack depth before the instruction.
+    uint64_t time;        // TSC cycles on x86, monotonic ns elsewhere.
+} TraceRecord;
+
+// Keeps the last `capacity` records of a run. Nothing is formatted or
+// written while the program runs; the ring is dumped on error, on SIGUSR1
+// or at exit, and covitrace turns dumps into text.
+typedef struct TraceRing {
+    TraceRecord *records;
+    uint64_t mask;    // capacity - 1; capacity is a power of two.
+    uint64_t next;    // Records ever written; the next slot is next & mask.
+    char *dump_path;  // Where trace_dump_file() writes.
+    sig_atomic_t dump_seen; // Value of trace_dump_requests at the last dump.
+} TraceRing;
+
+// Dump file layout: this header, then `count` records, oldest first. Fields
+// are in host byte order; covitrace rejects a dump whose header does not
+// read back as written.
+#define TRACE_FILE_MAGIC "CVTR"
+#define TRACE_FILE_VERSION 1
+#define TRACE_CLOCK_TSC 1
+#define TRACE_CLOCK_NS 2
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size; // sizeof(TraceRecord)
+    uint32_t clock;       // TRACE_CLOCK_TSC or TRACE_CLOCK_NS
+    uint32_t capacity;
+    uint64_t total;       // Records written during the run, including overwritten ones.
+    uint64_t count;       // Records in this file.
+} TraceFileHeader;
+
+#define TRACE_DEFAULT_CAPACITY 16384
+#define TRACE_DEFAULT_PATH "covim.trace"
+
+// Bumped by the SIGUSR1 handler. Each ring remembers the count it last
+// dumped at, so one signal dumps every traced VM in the process once.
+extern volatile sig_atomic_t trace_dump_requests;
+
+// 1 if SIGUSR1 arrived since `ring` last checked; records the request as seen.
+static inline int trace_dump_due(TraceRing *ring) {
+    sig_atomic_t requests = trace_dump_requests;
+    if (ring->dump_seen == requests) return 0;
+    ring->dump_seen = requests;
+    return 1;
+}
+
+// `capacity` is rounded up to a power of two. Returns NULL on allocation failure.
+TraceRing *trace_create(size_t capacity, const char *dump_path);
+void trace_free(TraceRing *ring);
+
+// Installs the SIGUSR1 handler that requests a dump.
+void trace_install_signal_handler(void);
+
+static inline uint64_t trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint32_t trace_clock_kind(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return TRACE_CLOCK_TSC;
+#else
+    return TRACE_CLOCK_NS;
+#endif
+}
+
+static inline void trace_record(TraceRing *ring, uint32_t pc, uint8_t opcode,
+                                uint8_t call_depth, uint16_t stack_depth) {
+    TraceRecord *r = &ring->records[ring->next++ & ring->mask];
+    r->pc = pc;
+    r->opcode = opcode;
+    r->call_depth = call_depth;
+    r->stack_depth = stack_depth;
+    r->time = trace_clock();
+}
+
+// Writes the ring to `path` in the dump format. Returns 0 on success.
+int trace_dump_file(const TraceRing *ring, const char *path);
+
+// Formats records as text, one line per instruction, oldest first.
+// `first` is the sequence number of records[0].
+void trace_print_records(FILE *out, const TraceRecord *records, size_t count,
+                         uint64_t first, uint32_t clock);
+
+// Prints the records still held by the ring.
+void trace_print(FILE *out, const TraceRing *ring);
+
+#endif // TRACE_H
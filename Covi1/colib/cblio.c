@@ -1,49 +1,84 @@
-#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-void print(const char* text) {
-    const char* p = text;
-    while (*p) {
-        char c = *p;
-        __asm__ __volatile__ (
-            "movq $1, %%rax\n\t"   // syscall number 1 = write
-            "movq $1, %%rdi\n\t"   // file descriptor 1 (stdout)
-            "movq %0, %%rsi\n\t"   // address of character c
-            "movq $1, %%rdx\n\t"   // length = 1 byte
-            "syscall\n\t"
-            :
-            : "r"(&c)
-            : "%rax", "%rdi", "%rsi", "%rdx"
-        );
-        p++;
+// Output goes through a buffer per thread and reaches stdout in as few
+// write() calls as possible: when the buffer fills, on cblio_flush(), and
+// after each newline when stdout is a terminal. A string that would not fit
+// goes out together with the buffered bytes in one writev(), without being
+// copied.
+#define CBLIO_BUFFER_SIZE 8192
+
+typedef struct {
+    char data[CBLIO_BUFFER_SIZE];
+    size_t used;
+    int tty; // -1 until stdout has been checked.
+} OutBuffer;
+
+static _Thread_local OutBuffer out = { { 0 }, 0, -1 };
+
+// Writes every byte of `iov`, retrying short writes and EINTR. Output that
+// stdout refuses is dropped, as it was when each character was written on
+// its own.
+static void write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
     }
 }
 
-void printnl(const char* text) {
-    const char* p = text;
-    while (*p) {
-        char c = *p;
-        __asm__ __volatile__ (
-            "movq $1, %%rax\n\t"
-            "movq $1, %%rdi\n\t"
-            "movq %0, %%rsi\n\t"
-            "movq $1, %%rdx\n\t"
-            "syscall\n\t"
-            :
-            : "r"(&c)
-            : "%rax", "%rdi", "%rsi", "%rdx"
-        );
-        p++;
+void cblio_flush(void) {
+    if (out.used == 0)
+        return;
+    struct iovec iov = { out.data, out.used };
+    write_all(&iov, 1);
+    out.used = 0;
+}
+
+static void append(const char* text, size_t len) {
+    if (out.tty < 0)
+        out.tty = isatty(STDOUT_FILENO);
+    if (len > CBLIO_BUFFER_SIZE - out.used) {
+        struct iovec iov[2] = { { out.data, out.used }, { (void *)text, len } };
+        write_all(iov, 2);
+        out.used = 0;
+        return;
     }
-    char nl = '\n';
-    __asm__ __volatile__ (
-        "movq $1, %%rax\n\t"
-        "movq $1, %%rdi\n\t"
-        "movq %0, %%rsi\n\t"
-        "movq $1, %%rdx\n\t"
-        "syscall\n\t"
-        :
-        : "r"(&nl)
-        : "%rax", "%rdi", "%rsi", "%rdx"
-    );
-}
\ No newline at end of file
+    memcpy(out.data + out.used, text, len);
+    out.used += len;
+    if (out.tty && memchr(text, '\n', len))
+        cblio_flush();
+}
+
+void print_len(const char* text, size_t len) {
+    append(text, len);
+}
+
+void printnl_len(const char* text, size_t len) {
+    append(text, len);
+    append("\n", 1);
+}
+
+void print(const char* text) {
+    append(text, strlen(text));
+}
+
+void printnl(const char* text) {
+    printnl_len(text, strlen(text));
+}